@@ -5,40 +5,348 @@
 
 #include <iostream>
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NOD_X86
+#endif
 
 #define QMARK '?'
 
 using namespace std;
 using LL = long long;
-// Krotka do trzymania informacji o aucie.
-using car_info = tuple<LL, string, LL, LL, LL, bool, bool>;
 
-// Komparator sortujący drogi.
-struct comp_road
+// Linia z oczekującym (niesparowanym) wjazdem auta, potrzebna tylko do zgłoszenia błędu.
+//      W trybie mmap pamiętany jest jedynie offset i długość linii w pliku.
+struct pending_text
 {
-    bool operator() (const string &a, const string &b) const
+    string text;
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+// Liczba możliwych identyfikatorów dróg: litera A lub S i numer z zakresu [1, 999].
+constexpr int ROAD_COUNT = 2 * 1000;
+
+// Źródło kolejnych linii wejścia. Plik zwykły jest mapowany w pamięci, a pozostałe
+//      wejścia (np. potok na stdin) czytane są dużymi blokami. Linie zwracane są
+//      jako widoki na bufor, ważne do następnego wywołania next().
+class line_source
+{
+    static constexpr size_t BLOCK_SIZE = 1 << 22;
+
+    int fd;
+    const char *data = nullptr;     // Początek danych (mapa albo bufor).
+    size_t length = 0;              // Liczba dostępnych bajtów danych.
+    size_t pos = 0;                 // Pozycja początku kolejnej linii w danych.
+    size_t base = 0;                // Offset w pliku odpowiadający data[0].
+    size_t last_offset = 0;         // Offset w pliku ostatnio zwróconej linii.
+    bool is_mapped = false;
+    bool eof = false;
+    vector<char> buffer;
+
+    // Dociągnięcie kolejnego bloku w trybie buforowanym (false = koniec wejścia).
+    bool refill()
+    {
+        size_t rest = length - pos;
+        if (pos > 0)
+        {
+            memmove(buffer.data(), buffer.data() + pos, rest);
+            base += pos;
+            pos = 0;
+        }
+        if (rest == buffer.size())
+            buffer.resize(buffer.size() * 2);
+        length = rest;
+
+        ssize_t got;
+        do
+        {
+            got = read(fd, buffer.data() + length, buffer.size() - length);
+        } while (got < 0 && errno == EINTR);
+
+        data = buffer.data();
+        if (got <= 0)
+        {
+            eof = true;
+            return false;
+        }
+        length += got;
+        return true;
+    }
+
+public:
+    explicit line_source(int input_fd) : fd(input_fd)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(map);
+                length = st.st_size;
+                is_mapped = true;
+                eof = true;
+                return;
+            }
+        }
+        buffer.resize(BLOCK_SIZE);
+        data = buffer.data();
+    }
+
+    line_source(const line_source&) = delete;
+    line_source& operator=(const line_source&) = delete;
+
+    ~line_source()
+    {
+        if (is_mapped)
+            munmap(const_cast<char*>(data), length);
+    }
+
+    // Wczytanie kolejnej linii (bez znaku końca linii) tak jak robi to getline.
+    bool next(string_view &line)
+    {
+        while (true)
+        {
+            const char *nl = static_cast<const char*>(memchr(data + pos, '\n', length - pos));
+            if (nl != nullptr)
+            {
+                size_t end = nl - data;
+                line = string_view(data + pos, end - pos);
+                last_offset = base + pos;
+                pos = end + 1;
+                return true;
+            }
+            if (eof || refill() == false)
+                break;
+        }
+
+        if (pos == length)
+            return false;
+        line = string_view(data + pos, length - pos);
+        last_offset = base + pos;
+        pos = length;
+        return true;
+    }
+
+    bool mapped() const
+    {
+        return is_mapped;
+    }
+
+    // Fragment zmapowanego pliku (tylko w trybie mmap).
+    string_view at(size_t offset, size_t len) const
+    {
+        return string_view(data + offset, len);
+    }
+
+    // Wczytanie kolejnego bloku pełnych linii (razem ze znakami końca linii) o rozmiarze
+    //      około max_size bajtów. Blok jest ważny do następnego wywołania.
+    bool next_block(string_view &block, size_t &block_offset, size_t max_size)
     {
-        int l1 = 0, l2 = 0;
-        for (size_t i = 1; i < a.length(); i++)
+        while (is_mapped == false && eof == false && length - pos < max_size)
+            refill();
+
+        while (pos < length)
         {
-            l1 *= 10;
-            l1 += a[i] - '0';
+            size_t end = min(length, pos + max_size);
+            const char *nl = static_cast<const char*>(memchr(data + end - 1, '\n', length - end + 1));
+            if (nl != nullptr)
+                end = nl - data + 1;
+            else if (eof)
+                end = length;
+            else
+            {
+                refill();
+                continue;
+            }
+            block = string_view(data + pos, end - pos);
+            block_offset = base + pos;
+            pos = end;
+            return true;
         }
-        for (size_t i = 1; i < b.length(); i++)
+        return false;
+    }
+
+    // Offset w wejściu pierwszego jeszcze nieprzeczytanego bajtu.
+    size_t consumed() const
+    {
+        return base + pos;
+    }
+
+    // Pominięcie wejścia do podanego offsetu (przy wznawianiu z zapisanego stanu).
+    //      Wejścia, w których nie da się przesunąć pozycji, są doczytywane.
+    bool skip_to(size_t offset)
+    {
+        if (is_mapped)
         {
-            l2 *= 10;
-            l2 += b[i] - '0';
+            pos = min(offset, length);
+            return pos == offset;
         }
-        if (l1 == l2)
+        if (length == 0 && lseek(fd, offset, SEEK_SET) == (off_t)offset)
         {
-            return a[0] < b[0];
+            base = offset;
+            return true;
         }
-        return l1 < l2;
+        while (base + length < offset && refill())
+            pos = length;
+        pos = min(offset - base, length);
+        return base + pos == offset;
+    }
+
+    // Offset w wejściu pierwszego bajtu ostatnio zwróconej linii.
+    size_t offset() const
+    {
+        return last_offset;
     }
 };
 
+/*
+ * Klasyfikacja znaków niezależna od locale. Linie do LINE_BLOCK bajtów klasyfikowane
+ * są naraz (SSE2/AVX2 wybierane w czasie działania, z wersją skalarną w zapasie),
+ * a podział na słowa i sprawdzenie identyfikatorów robione są na maskach bitowych.
+ * Akceptowane są dokładnie te same linie co przez isspace/isalpha/isdigit w locale "C".
+ */
+
+constexpr size_t LINE_BLOCK = 64;
+
+enum char_class : uint8_t { CH_BLANK = 1, CH_DIGIT = 2, CH_ALPHA = 4 };
+
+constexpr array<uint8_t, 256> make_char_classes()
+{
+    array<uint8_t, 256> classes{};
+    for (int c = 9; c <= 13; c++)
+        classes[c] = CH_BLANK;
+    classes[' '] = CH_BLANK;
+    for (int c = '0'; c <= '9'; c++)
+        classes[c] = CH_DIGIT;
+    for (int c = 'a'; c <= 'z'; c++)
+        classes[c] = classes[c - 'a' + 'A'] = CH_ALPHA;
+    return classes;
+}
+
+constexpr array<uint8_t, 256> CHAR_CLASSES = make_char_classes();
+
+inline bool is_blank(char c)
+{
+    return CHAR_CLASSES[(unsigned char)c] & CH_BLANK;
+}
+
+inline bool is_digit(char c)
+{
+    return CHAR_CLASSES[(unsigned char)c] & CH_DIGIT;
+}
+
+inline bool is_alnum(char c)
+{
+    return CHAR_CLASSES[(unsigned char)c] & (CH_DIGIT | CH_ALPHA);
+}
+
+// Maski klas znaków bloku LINE_BLOCK bajtów (bit i opisuje znak i).
+struct char_masks
+{
+    uint64_t blank;
+    uint64_t digit;
+    uint64_t alnum;
+};
+
+char_masks classify_scalar(const char *block)
+{
+    char_masks m = {0, 0, 0};
+    for (size_t i = 0; i < LINE_BLOCK; i++)
+    {
+        uint8_t c = CHAR_CLASSES[(unsigned char)block[i]];
+        m.blank |= uint64_t(c & CH_BLANK) << i;
+        m.digit |= uint64_t((c & CH_DIGIT) >> 1) << i;
+        m.alnum |= uint64_t(c != 0 && (c & CH_BLANK) == 0) << i;
+    }
+    return m;
+}
+
+#ifdef NOD_X86
+// Bajty v, dla których (v - low) jako liczba bez znaku jest nie większa niż span.
+#define NOD_IN_RANGE(ISA, v, low, span)                                             \
+    _mm##ISA##_cmpeq_epi8(_mm##ISA##_min_epu8(_mm##ISA##_sub_epi8(v,                \
+        _mm##ISA##_set1_epi8(low)), _mm##ISA##_set1_epi8(span)),                    \
+        _mm##ISA##_sub_epi8(v, _mm##ISA##_set1_epi8(low)))
+
+__attribute__((target("sse2")))
+char_masks classify_sse2(const char *block)
+{
+    char_masks m = {0, 0, 0};
+    for (size_t i = 0; i < LINE_BLOCK; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                NOD_IN_RANGE(, v, 9, 4));
+        __m128i digit = NOD_IN_RANGE(, v, '0', 9);
+        __m128i alpha = NOD_IN_RANGE(, _mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 25);
+        m.blank |= uint64_t(uint16_t(_mm_movemask_epi8(blank))) << i;
+        m.digit |= uint64_t(uint16_t(_mm_movemask_epi8(digit))) << i;
+        m.alnum |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_or_si128(digit, alpha)))) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+char_masks classify_avx2(const char *block)
+{
+    char_masks m = {0, 0, 0};
+    for (size_t i = 0; i < LINE_BLOCK; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                NOD_IN_RANGE(256, v, 9, 4));
+        __m256i digit = NOD_IN_RANGE(256, v, '0', 9);
+        __m256i alpha = NOD_IN_RANGE(256, _mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 25);
+        m.blank |= uint64_t(uint32_t(_mm256_movemask_epi8(blank))) << i;
+        m.digit |= uint64_t(uint32_t(_mm256_movemask_epi8(digit))) << i;
+        m.alnum |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)))) << i;
+    }
+    return m;
+}
+
+#undef NOD_IN_RANGE
+#endif
+
+using classify_fn = char_masks (*)(const char*);
+
+// Wybór najszybszej wersji klasyfikacji dostępnej na tym procesorze.
+classify_fn best_classify()
+{
+#ifdef NOD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return classify_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return classify_sse2;
+#endif
+    return classify_scalar;
+}
+
+classify_fn classify_block = best_classify();
+
+// Wersje klasyfikacji działające na tym procesorze (do pomiarów).
+vector<pair<const char*, classify_fn>> classify_variants()
+{
+    vector<pair<const char*, classify_fn>> variants = {{"scalar", classify_scalar}};
+#ifdef NOD_X86
+    if (__builtin_cpu_supports("sse2"))
+        variants.emplace_back("sse2", classify_sse2);
+    if (__builtin_cpu_supports("avx2"))
+        variants.emplace_back("avx2", classify_avx2);
+#endif
+    return variants;
+}
+
 // Sprawdzenie czy identyfikator drogi jest zgodny z poleceniem zadania (true = błędne dane).
-bool wrong_road(string &potential_road)
+bool wrong_road(string_view potential_road)
 {
     if (potential_road.length() < 2 || potential_road.length() > 4)
         return true;
@@ -47,7 +355,7 @@ bool wrong_road(string &potential_road)
         return true;
 
     for (size_t i=1; i<potential_road.length(); ++i)
-        if (isdigit(potential_road[i]) == false)
+        if (is_digit(potential_road[i]) == false)
             return true;
 
     if (potential_road[1] == '0')
@@ -57,41 +365,48 @@ bool wrong_road(string &potential_road)
 }
 
 // Sprawdzenie czy identyfikator auta jest zgodny z poleceniem zadania (true = błędne dane).
-bool wrong_car(string &potential_car)
+bool wrong_car(string_view potential_car)
 {
     if (potential_car.length() < 3 || potential_car.length() > 11)
         return true;
 
     for (auto sign:potential_car)
-        if (isalpha(sign) == false && isdigit(sign) == false)
+        if (is_alnum(sign) == false)
             return true;
 
     return false;
 }
 
-// Przetworzenie linii na polecenie zapytania (true = błędne dane).
-bool analyse_query(string &line, string &index)
+// Pominięcie białych znaków zaczynając od pozycji i.
+inline void skip_blank(string_view line, size_t &i)
 {
-    size_t i = 1;
-    while (i < line.length() && isspace(line[i]))
+    while (i < line.length() && is_blank(line[i]))
         i++;
+}
 
-    index = "";
-    while (i < line.length() && isspace(line[i]) == false)
-    {
-        index += line[i];
+// Wycięcie (bez kopiowania) słowa zaczynającego się na pozycji i.
+inline string_view read_word(string_view line, size_t &i)
+{
+    size_t begin = i;
+    while (i < line.length() && is_blank(line[i]) == false)
         i++;
-    }
+    return line.substr(begin, i - begin);
+}
 
-    while (i < line.length() && isspace(line[i]))
-        i++;
+// Przetworzenie linii na polecenie zapytania (true = błędne dane).
+bool analyse_query(string_view line, string_view &index)
+{
+    size_t i = 1;
+    skip_blank(line, i);
+    index = read_word(line, i);
+    skip_blank(line, i);
 
     return i != line.length() || (wrong_road(index) && wrong_car(index) && index != "");
 }
 
 // Sprawdzenie czy identyfikator pozycji auta na drodze
 //      jest zgodny z poleceniem zadania (true = błędne dane).
-bool wrong_height(LL &height, string height_str)
+bool wrong_height(LL &height, string_view height_str)
 {
     if (height_str.length() < 3)
         return true;
@@ -102,230 +417,2277 @@ bool wrong_height(LL &height, string height_str)
     if (height_str[0] == '0' && height_str[1] != ',')
         return true;
 
-    height = 0;
+    uint64_t value = 0;
     for (size_t i = 0; i < height_str.length(); ++i)
     {
-        if (isdigit(height_str[i]) == false)
+        if (is_digit(height_str[i]) == false)
         {
             if (i != (height_str.length() - 2) || height_str[i] != ',')
                 return true;
         }
         else
         {
-            height = height*10 + (height_str[i] - '0');
+            value = value*10 + (height_str[i] - '0');
         }
     }
 
+    height = value;
     return false;
 }
 
 // Preprocessing analizy wczytanej linii - ucięcie białych znaków z przodu.
-string cut_blank_prefix(string line)
+inline string_view cut_blank_prefix(string_view line)
 {
-    string res = "";
     size_t i = 0;
-    while (i < line.length() && isspace(line[i]))
-        i++;
-    while (i < line.length())
-        res += line[i++];
-    return res;
+    skip_blank(line, i);
+    return line.substr(i);
 }
 
 // Przetworzenie linii na polecenie wczytania informacji (true = błędne dane).
-bool analyse_data_insertion(string &line, string &car, string &road, LL &height)
+bool analyse_data_insertion(string_view line, string_view &car, string_view &road, LL &height)
 {
     size_t i = 0;
-    while (i < line.length() && isspace(line[i]))
-        i++;
+    skip_blank(line, i);
+    car = read_word(line, i);
+    skip_blank(line, i);
+    road = read_word(line, i);
+    skip_blank(line, i);
+    string_view height_str = read_word(line, i);
+    skip_blank(line, i);
 
-    car = "";
-    while (i < line.length() && isspace(line[i]) == false)
-    {
-        car += line[i];
-        i++;
-    }
+    return i != line.length() || wrong_car(car) || wrong_road(road) || wrong_height(height, height_str);
+}
 
-    while (i < line.length() && isspace(line[i]))
-        i++;
+// Długość ciągu jedynek w masce zaczynającego się od bitu start.
+inline size_t run_length(uint64_t mask, size_t start)
+{
+    uint64_t rest = ~(mask >> start);
+    return rest == 0 ? LINE_BLOCK - start : __builtin_ctzll(rest);
+}
 
-    road = "";
-    while (i < line.length() && isspace(line[i]) == false)
-    {
-        road += line[i];
-        i++;
-    }
+// Maska n najmłodszych bitów.
+inline uint64_t low_bits(size_t n)
+{
+    return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
 
-    while (i < line.length() && isspace(line[i]))
-        i++;
+// Wstępna analiza krótkiej linii na maskach bitowych (zob. analyse_line).
+bool analyse_short_line(string_view line, string_view &index, string_view &car,
+        string_view &road, LL &height)
+{
+    alignas(64) char block[LINE_BLOCK] = {};
+    memcpy(block, line.data(), line.length());
+    char_masks m = classify_block(block);
+    uint64_t valid = low_bits(line.length());
+    uint64_t word = ~m.blank & valid;
 
-    string height_str = "";
-    while (i < line.length() && isspace(line[i]) == false)
+    if (line.empty() == false && line[0] == QMARK)
     {
-        height_str += line[i];
-        i++;
+        word &= ~1ULL;
+        uint64_t starts = word & ~(word << 1);
+        if (starts == 0)
+        {
+            index = string_view();
+            return false;
+        }
+        if ((starts & (starts - 1)) != 0)
+            return true;
+        size_t begin = __builtin_ctzll(starts);
+        index = line.substr(begin, run_length(word, begin));
+        return wrong_road(index) && wrong_car(index);
     }
 
-    while (i < line.length() && isspace(line[i]))
-        i++;
+    uint64_t starts = word & ~(word << 1);
+    if (__builtin_popcountll(starts) != 3)
+        return true;
 
-    return i != line.length() || wrong_car(car) || wrong_road(road) || wrong_height(height, height_str);
+    size_t begin = __builtin_ctzll(starts);
+    size_t length = run_length(word, begin);
+    if (length < 3 || length > 11 || ((m.alnum >> begin) & low_bits(length)) != low_bits(length))
+        return true;
+    car = line.substr(begin, length);
+
+    starts &= starts - 1;
+    begin = __builtin_ctzll(starts);
+    length = run_length(word, begin);
+    if (length < 2 || length > 4 || (line[begin] != 'S' && line[begin] != 'A')
+            || line[begin + 1] == '0'
+            || ((m.digit >> (begin + 1)) & low_bits(length - 1)) != low_bits(length - 1))
+        return true;
+    road = line.substr(begin, length);
+
+    starts &= starts - 1;
+    begin = __builtin_ctzll(starts);
+    length = run_length(word, begin);
+    if (length < 3 || line[begin + length - 2] != ','
+            || (line[begin] == '0' && line[begin + 1] != ',')
+            || ((m.digit >> begin) & low_bits(length)) != (low_bits(length) & ~(1ULL << (length - 2))))
+        return true;
+
+    uint64_t value = 0;
+    for (size_t i = begin; i < begin + length; i++)
+        if (i != begin + length - 2)
+            value = value * 10 + (line[i] - '0');
+    height = value;
+    return false;
 }
 
-// Wstępna analiza wczytanej linii.
-inline bool analyse_line(string &line, string &index, string &car, string &road, LL &height)
+// Wstępna analiza wczytanej linii. Krótkie linie (praktycznie wszystkie poprawne)
+//      analizowane są na maskach bitowych, dłuższe znak po znaku.
+inline bool analyse_line(string_view line, string_view &index, string_view &car,
+        string_view &road, LL &height)
 {
-    if (line[0] == QMARK)
+    if (line.length() <= LINE_BLOCK)
+        return analyse_short_line(line, index, car, road, height);
+    else if (line[0] == QMARK)
         return analyse_query(line, index);
     else
         return analyse_data_insertion(line, car, road, height);
 }
 
-// Wypisanie liczby kilometrów w formacie z zadania.
-inline string int_to_string(LL x)
+// Pary cyfr "00", "01", ..., "99" do formatowania liczb po dwie cyfry naraz.
+constexpr array<char, 200> make_digit_pairs()
 {
-    string res = "";
-    res += (char)(x % 10 + '0');
-    res = ',' + res;
+    array<char, 200> pairs{};
+    for (int i = 0; i < 100; i++)
+    {
+        pairs[2 * i] = '0' + i / 10;
+        pairs[2 * i + 1] = '0' + i % 10;
+    }
+    return pairs;
+}
+
+constexpr array<char, 200> DIGIT_PAIRS = make_digit_pairs();
+
+// Dopisanie do bufora liczby kilometrów (podanej w dziesiątych częściach) w formacie
+//      z zadania. Liczba składana jest od końca w buforze na stosie, bez alokacji.
+inline void append_km(string &out, uint64_t x)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    *--p = '0' + x % 10;
+    *--p = ',';
     x /= 10;
-    if (x == 0)
+    while (x >= 100)
     {
-        res = '0' + res;
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS.data() + 2 * (x % 100), 2);
+        x /= 100;
     }
-    while (x != 0)
+    if (x >= 10)
     {
-        res = (char)(x % 10 + '0') + res;
-        x /= 10;
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS.data() + 2 * x, 2);
     }
-    return res;
+    else
+    {
+        *--p = '0' + x;
+    }
+    out.append(p, end - p);
 }
 
-// Obsługa polecenia wczytania informacji.
-void insert_data(LL line, string car, string road, LL height,
-        map<string, car_info*> &car_status, map<string, LL, comp_road> &road_status,
-        map <LL, string> &line_db)
+// Przechowywanie tekstu linii oczekujących wjazdów. Tekst trzymany jest tylko dopóki
+//      auto ma otwarty wjazd, więc zajęta pamięć zależy od liczby aut w trasie.
+class pending_store
 {
-    if (car_status.find(car) == car_status.end())
+    const line_source &source;
+    size_t retained = 0;
+    size_t peak = 0;
+
+    size_t cost(const pending_text &p) const
     {
-        car_info* new_info = new car_info;
-        *new_info = make_tuple(0, "", 0, 0, 0, false, false);
-        car_status[car] = new_info;
+        return source.mapped() ? sizeof(p.offset) + sizeof(p.length) : p.length;
     }
-    car_info* wsk = car_status[car];
 
-    if (get<0>(*wsk) > 0 && get<1>(*wsk) != road)
+public:
+    explicit pending_store(const line_source &input) : source(input) {}
+
+    // Zapamiętanie linii nowego wjazdu (poprzedni musi być już zwolniony).
+    void keep(pending_text &p, string_view line, size_t offset)
     {
-        cerr << "Error in line " << get<0>(*wsk) << ": " << line_db[get<0>(*wsk)] << "\n";
-                get<0>(*wsk) = 0;
+        p.offset = offset;
+        p.length = line.length();
+        if (source.mapped() == false)
+            p.text.assign(line);
+        retained += cost(p);
+        peak = max(peak, retained);
     }
 
-    if (get<0>(*wsk) > 0 && get<1>(*wsk) == road)
+    // Zwolnienie linii wjazdu, który został sparowany albo okazał się błędny.
+    void drop(pending_text &p)
     {
-        road_status[road] += abs(height - get<2>(*wsk));
-        if (road[0] == 'A')
-        {
-            get<3>(*wsk) += abs(height - get<2>(*wsk));
-            get<5>(*wsk) = true;
-        }
-        else if (road[0] == 'S')
-        {
-            get<4>(*wsk) += abs(height - get<2>(*wsk));
-            get<6>(*wsk) = true;
-        }
-        get<0>(*wsk) = 0;
+        retained -= cost(p);
+        p.length = 0;
+        string().swap(p.text);
     }
-    else
+
+    string_view text(const pending_text &p) const
     {
-        get<0>(*wsk) = line;
-        get<1>(*wsk) = road;
-        get<2>(*wsk) = height;
+        return source.mapped() ? source.at(p.offset, p.length) : string_view(p.text);
     }
+
+    size_t peak_bytes() const
+    {
+        return peak;
+    }
+};
+
+// Indeks drogi w tablicy dróg. Kolejność indeksów pokrywa się z kolejnością wypisywania
+//      dróg: rosnąco po numerze, a przy równych numerach najpierw autostrada.
+//      Zakłada poprawny identyfikator (zob. wrong_road).
+inline int road_index(string_view road)
+{
+    int number = 0;
+    for (size_t i = 1; i < road.length(); i++)
+        number = number * 10 + (road[i] - '0');
+    return 2 * number + (road[0] == 'S');
+}
+
+// Indeks drogi, którą wskazuje identyfikator z zapytania, albo -1. Jak w pierwotnym
+//      porównaniu dróg liczy się pierwsza litera i wartość pozostałych znaków
+//      traktowanych jak cyfry, więc np. zapytanie o auto A01 trafia też w drogę A1.
+inline int road_lookup(string_view where)
+{
+    if (where.empty() || (where[0] != 'A' && where[0] != 'S'))
+        return -1;
+    uint32_t number = 0;
+    for (size_t i = 1; i < where.length(); i++)
+        number = number * 10 + (where[i] - '0');
+    if ((int32_t)number < 1 || number >= ROAD_COUNT / 2)
+        return -1;
+    return 2 * number + (where[0] == 'S');
 }
 
-// Wypisanie informacji o aucie.
-void print_car(string car, car_info new_info)
+// Sumaryczne przejechane odległości na drogach, indeksowane przez road_index.
+struct road_table
 {
-    if (get<5>(new_info) == true || get<6>(new_info) == true)
+    array<LL, ROAD_COUNT> total{};
+    array<bool, ROAD_COUNT> present{};
+    bool track_changes = false;         // Czy zbierać drogi zmienione od ostatniego zrzutu.
+    array<bool, ROAD_COUNT> changed{};
+    vector<int> changed_list;
+
+    void add(int road, LL distance)
     {
-        cout << car;
-        if (get<5>(new_info) == true)
-        {
-            cout << " A " << int_to_string(get<3>(new_info));
-        }
-        if (get<6>(new_info) == true)
+        total[road] += distance;
+        present[road] = true;
+        if (track_changes && changed[road] == false)
         {
-            cout << " S " << int_to_string(get<4>(new_info));
+            changed[road] = true;
+            changed_list.push_back(road);
         }
-        cout << endl;
     }
-}
 
-// Obsługa polecenia zapytania.
-void query(string where, map<string, car_info*> &car_status, map<string, LL, comp_road> &road_status)
+    void clear_changes()
+    {
+        for (int road : changed_list)
+            changed[road] = false;
+        changed_list.clear();
+    }
+};
+
+// Tablica aut w układzie struktury tablic. Numery rejestracyjne zamieniane są na zwarte
+//      indeksy przez tablicę haszującą z adresowaniem otwartym.
+class car_table
 {
-    if (where == "")
+    static constexpr size_t PLATE_SIZE = 11;
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    // Numer rejestracyjny przechowywany w miejscu (co najwyżej 11 znaków).
+    struct plate_key
     {
-        for (auto p : car_status)
-        {
-            print_car(p.first, *(p.second));
-        }
-        for (auto p : road_status)
+        char chars[PLATE_SIZE];
+        uint8_t length;
+
+        string_view view() const
         {
-            cout << p.first << " " << int_to_string(p.second) << endl;
+            return string_view(chars, length);
         }
+    };
+
+    vector<uint32_t> slots = vector<uint32_t>(1024, EMPTY);
+    vector<plate_key> plates;
+    vector<uint32_t> sorted;        // Indeksy aut posortowane po numerach (leniwie).
+    size_t sorted_count = 0;        // Ile pierwszych aut jest już w sorted.
+
+public:
+    static uint64_t hash(string_view plate)
+    {
+        uint64_t lo = 0, hi = 0;
+        memcpy(&lo, plate.data(), min<size_t>(plate.length(), 8));
+        if (plate.length() > 8)
+            memcpy(&hi, plate.data() + 8, plate.length() - 8);
+        uint64_t h = (lo ^ (hi << 8 | plate.length())) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
     }
-    else
+
+private:
+    void grow()
     {
-        if (car_status.find(where) != car_status.end())
+        vector<uint32_t> old(slots.size() * 2, EMPTY);
+        swap(old, slots);
+        size_t mask = slots.size() - 1;
+        for (uint32_t car : old)
         {
-            print_car(where, *(car_status[where]));
+            if (car == EMPTY)
+                continue;
+            size_t i = hash(plates[car].view()) & mask;
+            while (slots[i] != EMPTY)
+                i = (i + 1) & mask;
+            slots[i] = car;
         }
-        if (road_status.find(where) != road_status.end())
+    }
+
+public:
+    // Kolumny stanu aut, indeksowane numerem auta.
+    vector<LL> pending_line;        // Linia oczekującego wjazdu (0 = brak).
+    vector<int16_t> pending_road;   // Droga oczekującego wjazdu.
+    vector<LL> pending_height;      // Pozycja oczekującego wjazdu.
+    vector<pending_text> pending;   // Tekst linii oczekującego wjazdu.
+    vector<LL> total_a;             // Suma odległości na autostradach.
+    vector<LL> total_s;             // Suma odległości na drogach ekspresowych.
+    vector<uint8_t> seen;           // Bit 0 - jechał autostradą, bit 1 - drogą ekspresową.
+    vector<uint8_t> changed;        // Czy sumy zmieniły się od ostatniego zrzutu.
+    vector<uint32_t> changed_list;  // Auta zmienione od ostatniego zrzutu.
+    bool track_changes = false;     // Czy zbierać auta zmienione od ostatniego zrzutu.
+
+    size_t size() const
+    {
+        return plates.size();
+    }
+
+    string_view plate(uint32_t car) const
+    {
+        return plates[car].view();
+    }
+
+    // Indeks auta o podanym numerze albo EMPTY, jeśli nie ma go w tablicy.
+    uint32_t find(string_view plate) const
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(plate) & mask; slots[i] != EMPTY; i = (i + 1) & mask)
+            if (plates[slots[i]].view() == plate)
+                return slots[i];
+        return EMPTY;
+    }
+
+    // Indeks auta o podanym (poprawnym) numerze, dodanego w razie potrzeby.
+    uint32_t intern(string_view plate)
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(plate) & mask;
+        for (; slots[i] != EMPTY; i = (i + 1) & mask)
+            if (plates[slots[i]].view() == plate)
+                return slots[i];
+
+        uint32_t car = plates.size();
+        slots[i] = car;
+        plate_key key;
+        memcpy(key.chars, plate.data(), plate.length());
+        key.length = plate.length();
+        plates.push_back(key);
+        pending_line.push_back(0);
+        pending_road.push_back(0);
+        pending_height.push_back(0);
+        pending.emplace_back();
+        total_a.push_back(0);
+        total_s.push_back(0);
+        seen.push_back(0);
+        changed.push_back(0);
+
+        if (2 * plates.size() > slots.size())
+            grow();
+        return car;
+    }
+
+    static bool missing(uint32_t car)
+    {
+        return car == EMPTY;
+    }
+
+    void mark_changed(uint32_t car)
+    {
+        if (track_changes && changed[car] == 0)
         {
-            cout << where << " " << int_to_string(road_status[where]) << endl;
+            changed[car] = 1;
+            changed_list.push_back(car);
         }
     }
-}
 
-// Zwalnianie zaalokowanej pamięci.
-void clear_map(map<string, car_info*> &car_status) {
-	for (auto i : car_status) {
-		delete i.second;
-	}
-}
+    void clear_changes()
+    {
+        for (uint32_t car : changed_list)
+            changed[car] = 0;
+        changed_list.clear();
+    }
 
-int main()
-{
-    // Inicjalizacja zmiennych używanych w programie.
-    LL height, line_counter = 0;
-    string line;
-    string index, car, road;
-    map <string, car_info*> car_status;
-    map <string, LL, comp_road> road_status;
-    map <LL, string> line_db;
+    void sort_by_plate(vector<uint32_t> &list) const
+    {
+        sort(list.begin(), list.end(), [this](uint32_t a, uint32_t b)
+        {
+            return plates[a].view() < plates[b].view();
+        });
+    }
 
-    while (getline(cin, line))
+    // Indeksy aut posortowane po numerach. Dosortowywane są tylko auta dodane od
+    //      poprzedniego wywołania.
+    const vector<uint32_t>& in_order()
     {
-        string line_cut = cut_blank_prefix(line);
-        line_counter++;
-        if (line.empty() == false)
+        if (sorted_count < plates.size())
         {
-            if (analyse_line(line_cut, index, car, road, height) == false)
+            auto by_plate = [this](uint32_t a, uint32_t b)
             {
-                if (line_cut[0] == QMARK)
-                {
-                    query(index, car_status, road_status);
-                }
-                else
-                {
-                    line_db[line_counter] = line;
-                    insert_data(line_counter, car, road, height, car_status, road_status, line_db);
-                }
-            }
-            else cerr << "Error in line " << line_counter << ": " + line << endl;
+                return plates[a].view() < plates[b].view();
+            };
+            for (uint32_t car = sorted_count; car < plates.size(); car++)
+                sorted.push_back(car);
+            sort(sorted.begin() + sorted_count, sorted.end(), by_plate);
+            inplace_merge(sorted.begin(), sorted.begin() + sorted_count, sorted.end(), by_plate);
+            sorted_count = plates.size();
         }
+        return sorted;
     }
-	clear_map(car_status);
-    return 0;
+};
+
+// Dopisanie do bufora komunikatu o błędzie w linii o podanym numerze i treści.
+inline void append_error(string &err, LL line, string_view text)
+{
+    char number[24];
+    err += "Error in line ";
+    err.append(number, to_chars(number, number + sizeof(number), line).ptr - number);
+    err += ": ";
+    err += text;
+    err += '\n';
 }
 
+// Sumy odległości w oknach po window_lines kolejnych linii, trzymane w pierścieniu
+//      ostatnich okien. Liczniki dróg są zaalokowane z góry, a liczniki aut rosną tylko
+//      razem z liczbą aut i są zerowane leniwie (po numerze okna), więc rozpoczęcie
+//      nowego okna niczego nie alokuje. Przejazd liczy się do okna linii wyjazdu.
+class window_ring
+{
+    struct window
+    {
+        LL number = 0;                          // Numer okna w tym miejscu (0 = puste).
+        array<LL, ROAD_COUNT> road_total{};
+        array<bool, ROAD_COUNT> road_present{};
+        vector<LL> car_window;                  // Okno, którego dotyczą liczniki auta.
+        vector<LL> car_a;
+        vector<LL> car_s;
+        vector<uint8_t> car_seen;
+    };
+
+    LL window_lines;
+    vector<window> ring;
+    LL current = 1;                             // Numer okna ostatnio widzianej linii.
+
+public:
+    window_ring(LL lines, size_t windows) : window_lines(lines), ring(windows) {}
+
+    LL window_of(LL line) const
+    {
+        return (line - 1) / window_lines + 1;
+    }
+
+    // Przesunięcie bieżącego okna do okna zawierającego linię line.
+    void advance(LL line)
+    {
+        current = window_of(line);
+    }
+
+    LL current_window() const
+    {
+        return current;
+    }
+
+    void add(LL line, uint32_t car, int road, LL distance)
+    {
+        LL number = window_of(line);
+        window &w = ring[number % ring.size()];
+        if (w.number != number)
+        {
+            w.number = number;
+            w.road_total.fill(0);
+            w.road_present.fill(false);
+        }
+        if (car >= w.car_window.size())
+        {
+            size_t size = max<size_t>(car + 1, 2 * w.car_window.size());
+            w.car_window.resize(size, 0);
+            w.car_a.resize(size);
+            w.car_s.resize(size);
+            w.car_seen.resize(size);
+        }
+        if (w.car_window[car] != number)
+        {
+            w.car_window[car] = number;
+            w.car_a[car] = w.car_s[car] = 0;
+            w.car_seen[car] = 0;
+        }
 
+        w.road_total[road] += distance;
+        w.road_present[road] = true;
+        if (road % 2 == 0)
+        {
+            w.car_a[car] += distance;
+            w.car_seen[car] |= 1;
+        }
+        else
+        {
+            w.car_s[car] += distance;
+            w.car_seen[car] |= 2;
+        }
+    }
+
+    // Czy okno jest jednym z ostatnich ring.size() okien (może nie mieć przejazdów).
+    bool retained(LL number) const
+    {
+        return number >= 1 && number <= current && current - number < (LL)ring.size();
+    }
+
+    // Suma drogi w oknie; false, jeśli droga nie miała w nim przejazdów.
+    bool road(LL number, int road, LL &total) const
+    {
+        const window &w = ring[number % ring.size()];
+        if (retained(number) == false || w.number != number || w.road_present[road] == false)
+            return false;
+        total = w.road_total[road];
+        return true;
+    }
+
+    // Sumy auta w oknie (flagi jak w car_table::seen, 0 = brak przejazdów).
+    uint8_t car(LL number, uint32_t car, LL &total_a, LL &total_s) const
+    {
+        const window &w = ring[number % ring.size()];
+        if (retained(number) == false || w.number != number || car >= w.car_window.size()
+                || w.car_window[car] != number)
+            return 0;
+        total_a = w.car_a[car];
+        total_s = w.car_s[car];
+        return w.car_seen[car];
+    }
+};
+
+// Obsługa polecenia wczytania informacji. Błąd niesparowanego wjazdu trafia do err,
+//      a przejazdy są dodatkowo liczone w oknach, jeśli windows jest podane.
+void insert_data(LL line, string_view car_plate, string_view road_name, LL height,
+        string_view text, size_t offset, car_table &cars, road_table &roads,
+        pending_store &pending, string &err, window_ring *windows = nullptr)
+{
+    uint32_t car = cars.intern(car_plate);
+    int road = road_index(road_name);
+
+    if (cars.pending_line[car] > 0 && cars.pending_road[car] != road)
+    {
+        append_error(err, cars.pending_line[car], pending.text(cars.pending[car]));
+        pending.drop(cars.pending[car]);
+        cars.pending_line[car] = 0;
+    }
+
+    if (cars.pending_line[car] > 0 && cars.pending_road[car] == road)
+    {
+        LL distance = abs(height - cars.pending_height[car]);
+        roads.add(road, distance);
+        if (windows != nullptr)
+            windows->add(line, car, road, distance);
+        if (road_name[0] == 'A')
+        {
+            cars.total_a[car] += distance;
+            cars.seen[car] |= 1;
+        }
+        else if (road_name[0] == 'S')
+        {
+            cars.total_s[car] += distance;
+            cars.seen[car] |= 2;
+        }
+        cars.mark_changed(car);
+        cars.pending_line[car] = 0;
+        pending.drop(cars.pending[car]);
+    }
+    else
+    {
+        pending.keep(cars.pending[car], text, offset);
+        cars.pending_line[car] = line;
+        cars.pending_road[car] = road;
+        cars.pending_height[car] = height;
+    }
+}
+
+// Dopisanie do bufora wyjścia sum auta (seen jak w car_table::seen).
+void print_car(string_view plate, uint8_t seen, LL total_a, LL total_s, string &out)
+{
+    if (seen != 0)
+    {
+        out += plate;
+        if (seen & 1)
+        {
+            out += " A ";
+            append_km(out, total_a);
+        }
+        if (seen & 2)
+        {
+            out += " S ";
+            append_km(out, total_s);
+        }
+        out += '\n';
+    }
+}
+
+// Dopisanie do bufora wyjścia informacji o aucie.
+inline void print_car(const car_table &cars, uint32_t car, string &out)
+{
+    print_car(cars.plate(car), cars.seen[car], cars.total_a[car], cars.total_s[car], out);
+}
+
+// Dopisanie do bufora wyjścia sumy na drodze pod podaną nazwą.
+inline void print_road(string_view name, LL total, string &out)
+{
+    out += name;
+    out += ' ';
+    append_km(out, total);
+    out += '\n';
+}
+
+// Kanoniczna nazwa drogi o danym indeksie.
+inline string_view road_name(int road, char (&buffer)[8])
+{
+    int length = snprintf(buffer, sizeof(buffer), "%c%d", road % 2 == 0 ? 'A' : 'S', road / 2);
+    return string_view(buffer, length);
+}
+
+// Wypisanie całego bufora jednym zapisem.
+inline void flush_output(string &out, ostream &stream)
+{
+    if (out.empty() == false)
+    {
+        stream.write(out.data(), out.size());
+        stream.flush();
+        out.clear();
+    }
+}
+
+// Dopisanie do out pełnego zrzutu stanu renderowanego od zera.
+void print_state(car_table &cars, const road_table &roads, string &out)
+{
+    for (uint32_t car : cars.in_order())
+    {
+        print_car(cars, car, out);
+    }
+    char name[8];
+    for (int road = 0; road < ROAD_COUNT; road++)
+    {
+        if (roads.present[road])
+            print_road(road_name(road, name), roads.total[road], out);
+    }
+}
+
+// Wyrenderowana odpowiedź na pełne zapytanie. Linie aut i dróg leżą w snapshot jedna
+//      za drugą, a dla każdej pamiętane jest jej położenie. Między zapytaniami zbierane
+//      są auta i drogi, których sumy się zmieniły; linia o niezmienionej długości jest
+//      nadpisywana w miejscu. Gdy któraś linia zmieniła długość albo doszły nowe auta,
+//      snapshot składany jest od nowa, ale niezmienione linie są kopiowane ze starego,
+//      a nie renderowane. Zmiany zaczynają być zbierane dopiero przy pierwszym pełnym
+//      zapytaniu, a snapshot powstaje przy drugim, więc wejście bez powtarzanych
+//      pełnych zapytań nic za bufor nie płaci.
+class dump_cache
+{
+    struct line_span
+    {
+        size_t begin;
+        uint32_t length;
+    };
+
+    vector<line_span> car_spans;
+    array<line_span, ROAD_COUNT> road_spans{};
+    string snapshot;
+    string spare;                       // Bufor na składany snapshot.
+    string line;                        // Bufor na pojedynczą linię.
+    bool complete = false;              // Czy snapshot w ogóle został złożony.
+
+    // Nadpisanie w miejscu linii zmienionych aut i dróg (false = trzeba złożyć od nowa).
+    bool patch(const car_table &cars, const road_table &roads)
+    {
+        if (complete == false || car_spans.size() != cars.size())
+            return false;
+        for (uint32_t car : cars.changed_list)
+        {
+            line.clear();
+            print_car(cars, car, line);
+            if (line.length() != car_spans[car].length)
+                return false;
+            memcpy(&snapshot[car_spans[car].begin], line.data(), line.length());
+        }
+        char name[8];
+        for (int road : roads.changed_list)
+        {
+            line.clear();
+            if (roads.present[road])
+                print_road(road_name(road, name), roads.total[road], line);
+            if (line.length() != road_spans[road].length)
+                return false;
+            memcpy(&snapshot[road_spans[road].begin], line.data(), line.length());
+        }
+        return true;
+    }
+
+    // Złożenie snapshotu od nowa (przy pierwszym razie renderowane są wszystkie linie).
+    void rebuild(car_table &cars, const road_table &roads)
+    {
+        size_t known = complete ? car_spans.size() : 0;
+        car_spans.resize(cars.size());
+        spare.clear();
+        for (uint32_t car : cars.in_order())
+        {
+            line_span &span = car_spans[car];
+            size_t begin = spare.size();
+            if (car < known && cars.changed[car] == 0)
+                spare.append(snapshot, span.begin, span.length);
+            else
+                print_car(cars, car, spare);
+            span = {begin, uint32_t(spare.size() - begin)};
+        }
+        char name[8];
+        for (int road = 0; road < ROAD_COUNT; road++)
+        {
+            line_span &span = road_spans[road];
+            size_t begin = spare.size();
+            if (complete && roads.changed[road] == false)
+                spare.append(snapshot, span.begin, span.length);
+            else if (roads.present[road])
+                print_road(road_name(road, name), roads.total[road], spare);
+            span = {begin, uint32_t(spare.size() - begin)};
+        }
+        swap(snapshot, spare);
+        complete = true;
+    }
+
+public:
+    // Dopisanie do out pełnego zrzutu stanu.
+    void full(car_table &cars, road_table &roads, string &out)
+    {
+        if (cars.track_changes == false)
+        {
+            print_state(cars, roads, out);
+            cars.track_changes = roads.track_changes = true;
+            return;
+        }
+        if (patch(cars, roads) == false)
+            rebuild(cars, roads);
+        cars.clear_changes();
+        roads.clear_changes();
+        out += snapshot;
+    }
+
+    // Dopisanie do out tylko aut i dróg zmienionych od poprzedniego zrzutu (zmiany
+    //      muszą być zbierane od początku).
+    void delta(car_table &cars, road_table &roads, string &out)
+    {
+        vector<uint32_t> changed_cars = cars.changed_list;
+        cars.sort_by_plate(changed_cars);
+        for (uint32_t car : changed_cars)
+            print_car(cars, car, out);
+        vector<int> changed_roads = roads.changed_list;
+        sort(changed_roads.begin(), changed_roads.end());
+        char name[8];
+        for (int road : changed_roads)
+            print_road(road_name(road, name), roads.total[road], out);
+        cars.clear_changes();
+        roads.clear_changes();
+    }
+};
+
+// Obsługa polecenia zapytania. Pełne zapytanie korzysta z dump_cache, jeśli jest podany
+//      (a w trybie delta wypisuje tylko zmiany od poprzedniego pełnego zapytania).
+void query(string_view where, car_table &cars, road_table &roads, string &out,
+        dump_cache *cache = nullptr, bool delta = false)
+{
+    if (where == "")
+    {
+        if (cache != nullptr && delta)
+        {
+            cache->delta(cars, roads, out);
+            return;
+        }
+        if (cache != nullptr)
+            cache->full(cars, roads, out);
+        else
+            print_state(cars, roads, out);
+    }
+    else
+    {
+        uint32_t car = cars.find(where);
+        if (car_table::missing(car) == false)
+        {
+            print_car(cars, car, out);
+        }
+        int road = road_lookup(where);
+        if (road >= 0 && roads.present[road])
+        {
+            print_road(where, roads.total[road], out);
+        }
+    }
+}
+
+// Odcięcie z zapytania końcowego słowa "@N" (okno numer N) albo "@" (okno bieżące).
+//      Zwraca numer okna, 0 jeśli zapytanie nie dotyczy okna, albo -1 dla błędnego słowa.
+LL cut_window_spec(string_view &line, LL current)
+{
+    size_t end = line.length();
+    while (end > 0 && is_blank(line[end - 1]))
+        end--;
+    size_t begin = end;
+    while (begin > 0 && is_blank(line[begin - 1]) == false)
+        begin--;
+    if (begin == 0 || begin == end || line[begin] != '@')
+        return 0;
+
+    string_view spec = line.substr(begin + 1, end - begin - 1);
+    line = line.substr(0, begin);
+    if (spec.empty())
+        return current;
+    if (spec.length() > 18)
+        return -1;
+    LL number = 0;
+    for (char c : spec)
+    {
+        if (is_digit(c) == false)
+            return -1;
+        number = number * 10 + (c - '0');
+    }
+    return number > 0 ? number : -1;
+}
+
+// Obsługa zapytania o okno: jak query, ale z sumami z jednego okna.
+void query_window(string_view where, LL number, car_table &cars, const window_ring &windows,
+        string &out)
+{
+    LL total_a = 0, total_s = 0, total = 0;
+    if (where == "")
+    {
+        for (uint32_t car : cars.in_order())
+        {
+            uint8_t seen = windows.car(number, car, total_a, total_s);
+            print_car(cars.plate(car), seen, total_a, total_s, out);
+        }
+        char name[8];
+        for (int road = 0; road < ROAD_COUNT; road++)
+        {
+            if (windows.road(number, road, total))
+                print_road(road_name(road, name), total, out);
+        }
+    }
+    else
+    {
+        uint32_t car = cars.find(where);
+        if (car_table::missing(car) == false)
+        {
+            uint8_t seen = windows.car(number, car, total_a, total_s);
+            print_car(where, seen, total_a, total_s, out);
+        }
+        int road = road_lookup(where);
+        if (road >= 0 && windows.road(number, road, total))
+        {
+            print_road(where, total, out);
+        }
+    }
+}
+
+// Ustawienia programu z linii poleceń.
+struct options
+{
+    bool print_stats = false;       // -s: statystyki pamięci na koniec.
+    int threads = 1;                // -j N: liczba wątków przetwarzania.
+    bool bench = false;             // -b: pomiary wypisywane jako JSON.
+    bool delta = false;             // -d: pełne zapytanie wypisuje tylko zmiany.
+    string checkpoint;              // -c plik: zapis stanu do wznowienia przetwarzania.
+    LL checkpoint_lines = 0;        // -n N: zapis stanu co N linii.
+    double checkpoint_seconds = 0;  // -t T: zapis stanu co T sekund.
+    bool restore = false;           // -r: wznowienie ze stanu zapisanego w pliku z -c.
+    LL window_lines = 0;            // -w K: sumy także w oknach po K linii.
+    size_t windows = 24;            // -W R: liczba pamiętanych ostatnich okien.
+    bool pipeline = false;          // -p: potok wątków analiza / stan / wypisywanie.
+    size_t queue_capacity = 4096;   // -q N: pojemność kolejek między etapami potoku.
+};
+
+// Rodzaj wczytanej linii.
+enum line_kind : uint8_t { LINE_EMPTY, LINE_ERROR, LINE_QUERY, LINE_INSERT, LINE_END };
+
+// Rozpoznanie linii o podanym numerze. W trybie okien końcowe słowo "@N" zapytania
+//      trafia do window (0 = zapytanie nie dotyczy okna).
+line_kind parse_line(string_view line, LL number, const options &opt, string_view &index,
+        string_view &car, string_view &road, LL &height, LL &window)
+{
+    if (line.empty())
+        return LINE_EMPTY;
+    string_view line_cut = cut_blank_prefix(line);
+    window = 0;
+    if (opt.window_lines > 0 && line_cut.empty() == false && line_cut[0] == QMARK)
+    {
+        window = cut_window_spec(line_cut, (number - 1) / opt.window_lines + 1);
+        if (window < 0)
+            return LINE_ERROR;
+    }
+    if (analyse_line(line_cut, index, car, road, height))
+        return LINE_ERROR;
+    return line_cut[0] == QMARK ? LINE_QUERY : LINE_INSERT;
+}
+
+// Stan przetwarzania w jednym wątku (także etap stanu w potoku) razem z dodatkami
+//      wybranymi opcjami: buforem pełnego zrzutu, trybem delta i oknami.
+struct serial_engine
+{
+    const options &opt;
+    car_table cars;
+    road_table roads;
+    pending_store pending;
+    dump_cache cache;
+    unique_ptr<window_ring> windows;
+
+    serial_engine(const line_source &input, const options &options)
+        : opt(options), pending(input)
+    {
+        if (opt.window_lines > 0)
+            windows = make_unique<window_ring>(opt.window_lines, opt.windows);
+        cars.track_changes = roads.track_changes = opt.delta;
+    }
+
+    // Obsługa rozpoznanej linii: odpowiedzi trafiają do out, błędy do err.
+    void apply(line_kind kind, LL line, string_view text, size_t offset, string_view index,
+            string_view car, string_view road, LL height, LL window, string &out, string &err)
+    {
+        if (windows != nullptr)
+            windows->advance(line);
+        if (kind == LINE_ERROR)
+            append_error(err, line, text);
+        else if (kind == LINE_QUERY && window > 0)
+            query_window(index, window, cars, *windows, out);
+        else if (kind == LINE_QUERY)
+            query(index, cars, roads, out, &cache, opt.delta);
+        else if (kind == LINE_INSERT)
+            insert_data(line, car, road, height, text, offset, cars, roads, pending, err,
+                    windows.get());
+    }
+};
+
+/*
+ * Zapis stanu (checkpoint). Format binarny w kolejności bajtów maszyny:
+ *   "NODSTAT1", numer ostatniej przetworzonej linii, offset kolejnej linii,
+ *   liczba aut, a dla każdego auta: numer, oczekujący wjazd (linia, droga, pozycja,
+ *   offset i tekst linii), sumy, flagi; następnie sumy i flagi wszystkich dróg.
+ * Rozmiar zapisu i czas wczytania zależą tylko od rozmiaru stanu, nie logu.
+ */
+
+constexpr char STATE_MAGIC[8] = {'N', 'O', 'D', 'S', 'T', 'A', 'T', '1'};
+
+template<typename T>
+inline void put_raw(string &buf, const T &value)
+{
+    buf.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+inline bool take_raw(string_view &buf, T &value)
+{
+    if (buf.length() < sizeof(T))
+        return false;
+    memcpy(&value, buf.data(), sizeof(T));
+    buf.remove_prefix(sizeof(T));
+    return true;
+}
+
+// Serializacja stanu po przetworzeniu linii line; offset wskazuje początek kolejnej linii.
+string save_state(const car_table &cars, const road_table &roads, const pending_store &pending,
+        LL line, size_t offset)
+{
+    string buf(STATE_MAGIC, sizeof(STATE_MAGIC));
+    put_raw(buf, line);
+    put_raw(buf, (uint64_t)offset);
+    put_raw(buf, (uint64_t)cars.size());
+    for (uint32_t car = 0; car < cars.size(); car++)
+    {
+        string_view plate = cars.plate(car);
+        put_raw(buf, (uint8_t)plate.length());
+        buf += plate;
+        put_raw(buf, cars.pending_line[car]);
+        put_raw(buf, cars.pending_road[car]);
+        put_raw(buf, cars.pending_height[car]);
+        put_raw(buf, cars.total_a[car]);
+        put_raw(buf, cars.total_s[car]);
+        put_raw(buf, cars.seen[car]);
+        put_raw(buf, cars.changed[car]);
+        string_view text = cars.pending_line[car] > 0 ? pending.text(cars.pending[car]) : "";
+        put_raw(buf, (uint64_t)cars.pending[car].offset);
+        put_raw(buf, (uint64_t)text.length());
+        buf += text;
+    }
+    buf.append(reinterpret_cast<const char*>(roads.total.data()), sizeof(roads.total));
+    buf.append(reinterpret_cast<const char*>(roads.present.data()), sizeof(roads.present));
+    buf.append(reinterpret_cast<const char*>(roads.changed.data()), sizeof(roads.changed));
+    return buf;
+}
+
+// Sprawdzenie wczytanego auta tymi samymi regułami co dane wejściowe: numer jak
+//      w wrong_car, oczekujący wjazd na istniejącą drogę (jak w road_index) z linii
+//      i tekstu sprzed miejsca wznowienia, flagi z dozwolonego zakresu.
+bool valid_car(const car_table &cars, uint32_t car, LL line, uint64_t next_offset,
+        uint64_t text_offset, uint64_t text_length, uint8_t changed)
+{
+    if (wrong_car(cars.plate(car)) || cars.seen[car] > 3 || changed > 1
+            || cars.pending_line[car] < 0 || cars.pending_line[car] > line)
+        return false;
+    if (cars.pending_line[car] == 0)
+        return true;
+    return cars.pending_road[car] >= 2 && cars.pending_road[car] < ROAD_COUNT
+            && cars.pending_height[car] >= 0 && text_offset <= next_offset
+            && text_length <= next_offset - text_offset;
+}
+
+// Odtworzenie stanu z zapisu do pustych tablic (false = uszkodzony zapis).
+bool load_state(string_view buf, car_table &cars, road_table &roads, pending_store &pending,
+        LL &line, size_t &offset)
+{
+    if (buf.substr(0, sizeof(STATE_MAGIC)) != string_view(STATE_MAGIC, sizeof(STATE_MAGIC)))
+        return false;
+    buf.remove_prefix(sizeof(STATE_MAGIC));
+
+    uint64_t next_offset, count;
+    if (take_raw(buf, line) == false || take_raw(buf, next_offset) == false
+            || take_raw(buf, count) == false || line < 0)
+        return false;
+    offset = next_offset;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint8_t plate_length;
+        uint64_t text_offset, text_length;
+        if (take_raw(buf, plate_length) == false || buf.length() < plate_length)
+            return false;
+        uint32_t car = cars.intern(buf.substr(0, plate_length));
+        buf.remove_prefix(plate_length);
+        if (car != i)
+            return false;
+
+        uint8_t changed;
+        if (take_raw(buf, cars.pending_line[car]) == false
+                || take_raw(buf, cars.pending_road[car]) == false
+                || take_raw(buf, cars.pending_height[car]) == false
+                || take_raw(buf, cars.total_a[car]) == false
+                || take_raw(buf, cars.total_s[car]) == false
+                || take_raw(buf, cars.seen[car]) == false
+                || take_raw(buf, changed) == false
+                || take_raw(buf, text_offset) == false
+                || take_raw(buf, text_length) == false || buf.length() < text_length
+                || valid_car(cars, car, line, next_offset, text_offset, text_length,
+                        changed) == false)
+            return false;
+        if (changed)
+            cars.mark_changed(car);
+        if (cars.pending_line[car] > 0)
+            pending.keep(cars.pending[car], buf.substr(0, text_length), text_offset);
+        buf.remove_prefix(text_length);
+    }
+
+    if (buf.length() != sizeof(roads.total) + sizeof(roads.present) + sizeof(roads.changed))
+        return false;
+    // Flagi dróg muszą być poprawnymi wartościami bool, a indeksy 0 i 1 (numer 0) pustymi.
+    for (size_t i = sizeof(roads.total); i < buf.length(); i++)
+        if ((uint8_t)buf[i] > 1)
+            return false;
+    if (buf[sizeof(roads.total)] != 0 || buf[sizeof(roads.total) + 1] != 0)
+        return false;
+    memcpy(roads.total.data(), buf.data(), sizeof(roads.total));
+    memcpy(roads.present.data(), buf.data() + sizeof(roads.total), sizeof(roads.present));
+    array<bool, ROAD_COUNT> changed;
+    memcpy(changed.data(), buf.data() + sizeof(roads.total) + sizeof(roads.present),
+            sizeof(changed));
+    for (int road = 0; road < ROAD_COUNT; road++)
+    {
+        if (changed[road] && roads.track_changes && roads.changed[road] == false)
+        {
+            roads.changed[road] = true;
+            roads.changed_list.push_back(road);
+        }
+    }
+    return true;
+}
+
+// Okresowy zapis stanu do pliku. Stan serializowany jest w pamięci w wątku
+//      przetwarzania, a zapis na dysk (do pliku tymczasowego podmienianego przez
+//      rename) odbywa się w osobnym wątku, więc przetwarzanie stoi tylko na czas
+//      serializacji.
+class checkpointer
+{
+    const options &opt;
+    LL last_line = 0;
+    chrono::steady_clock::time_point last_time = chrono::steady_clock::now();
+    thread writer;
+    string error;                       // Opis błędu ostatniego zapisu (pusty = udany).
+
+    // Zapis do pliku tymczasowego i podmiana przez rename. Opis błędu trafia do error
+    //      i jest wypisywany przez wątek przetwarzania po zakończeniu zapisu.
+    static void write_file(string path, string data, string &error)
+    {
+        string tmp = path + ".tmp";
+        const char *failed = nullptr;
+        int code = 0;
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            failed = "open";
+            code = errno;
+        }
+        size_t done = 0;
+        while (failed == nullptr && done < data.size())
+        {
+            ssize_t written = write(fd, data.data() + done, data.size() - done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                failed = "write";
+                code = written < 0 ? errno : ENOSPC;
+            }
+            else
+                done += written;
+        }
+        if (failed == nullptr && fsync(fd) != 0)
+        {
+            failed = "fsync";
+            code = errno;
+        }
+        if (fd >= 0 && close(fd) != 0 && failed == nullptr)
+        {
+            failed = "close";
+            code = errno;
+        }
+        if (failed == nullptr && rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            failed = "rename";
+            code = errno;
+        }
+        if (failed != nullptr)
+        {
+            if (fd >= 0)
+                unlink(tmp.c_str());
+            error = "Cannot write checkpoint " + path + " (" + failed + ": " + strerror(code) + ")";
+        }
+    }
+
+public:
+    explicit checkpointer(const options &options) : opt(options) {}
+
+    checkpointer(const checkpointer&) = delete;
+    checkpointer& operator=(const checkpointer&) = delete;
+
+    ~checkpointer()
+    {
+        if (writer.joinable())
+            writer.join();
+    }
+
+    bool enabled() const
+    {
+        return opt.checkpoint.empty() == false;
+    }
+
+    // Czy po przetworzeniu linii line należy zapisać stan.
+    bool due(LL line)
+    {
+        if (opt.checkpoint_lines > 0 && line - last_line >= opt.checkpoint_lines)
+            return true;
+        // Zegar sprawdzany jest co 4096 linii, żeby nie spowalniać przetwarzania.
+        if (opt.checkpoint_seconds > 0 && (line & 4095) == 0)
+        {
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - last_time;
+            return elapsed.count() >= opt.checkpoint_seconds;
+        }
+        return false;
+    }
+
+    // Zaczekanie na trwający zapis i wypisanie jego błędu (false = zapis się nie udał).
+    bool finish()
+    {
+        if (writer.joinable())
+            writer.join();
+        if (error.empty())
+            return true;
+        cerr << error << endl;
+        error.clear();
+        return false;
+    }
+
+    void save(string data, LL line)
+    {
+        finish();
+        last_line = line;
+        last_time = chrono::steady_clock::now();
+        writer = thread(write_file, opt.checkpoint, std::move(data), ref(error));
+    }
+};
+
+// Wczytanie zapisanego stanu z pliku. Brak pliku oznacza start od początku wejścia.
+bool restore_state(const string &path, line_source &input, car_table &cars, road_table &roads,
+        pending_store &pending, LL &line_counter)
+{
+    ifstream file(path, ios::binary);
+    if (file.is_open() == false)
+        return true;
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    size_t offset;
+    if (load_state(data, cars, roads, pending, line_counter, offset) == false)
+    {
+        cerr << "Invalid checkpoint " << path << endl;
+        return false;
+    }
+    if (input.skip_to(offset) == false)
+    {
+        cerr << "Checkpoint " << path << " is beyond the end of input" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Przetworzenie całego wejścia w jednym wątku. Zwraca liczbę przetworzonych linii
+//      albo -1, jeśli nie udało się wznowić przetwarzania z zapisanego stanu albo
+//      zapisać stanu po końcu wejścia.
+LL process_serial(line_source &input, const options &opt)
+{
+    LL height, window, line_counter = 0;
+    string_view line;
+    string_view index, car, road;
+    serial_engine engine(input, opt);
+    string out, err;
+    checkpointer checkpoints(opt);
+
+    if (opt.restore && restore_state(opt.checkpoint, input, engine.cars, engine.roads,
+                engine.pending, line_counter) == false)
+        return -1;
+
+    while (input.next(line))
+    {
+        line_counter++;
+        line_kind kind = parse_line(line, line_counter, opt, index, car, road, height, window);
+        engine.apply(kind, line_counter, line, input.offset(), index, car, road, height, window,
+                out, err);
+        flush_output(err, cerr);
+        flush_output(out, cout);
+        if (checkpoints.enabled() && checkpoints.due(line_counter))
+            checkpoints.save(save_state(engine.cars, engine.roads, engine.pending, line_counter,
+                    input.consumed()), line_counter);
+    }
+    if (checkpoints.enabled())
+    {
+        checkpoints.save(save_state(engine.cars, engine.roads, engine.pending, line_counter,
+                input.consumed()), line_counter);
+        if (checkpoints.finish() == false)
+            return -1;
+    }
+    if (opt.print_stats)
+        cerr << "Peak retained pending bytes: " << engine.pending.peak_bytes() << endl;
+    return line_counter;
+}
+
+/*
+ * Tryb potokowy. Trzy wątki połączone kolejkami SPSC bez blokad: analiza linii,
+ * aktualizacja stanu oraz wypisywanie błędów i odpowiedzi. Pełna kolejka zatrzymuje
+ * etap, który do niej pisze (pojemność ustawia opcja -q), a każda kolejka zlicza
+ * swoją głębokość i czas czekania obu stron, co pokazuje, który etap jest wąskim gardłem.
+ */
+
+// Kolejka jednego producenta i jednego konsumenta na buforze cyklicznym.
+template<typename T>
+class spsc_ring
+{
+    using clock = chrono::steady_clock;
+
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0};         // Następny element do zdjęcia.
+    alignas(64) atomic<size_t> tail{0};         // Następne wolne miejsce.
+
+    // Statystyki producenta.
+    alignas(64) clock::duration push_wait{};
+    size_t max_depth = 0;
+    uint64_t depth_sum = 0;
+    uint64_t pushes = 0;
+    // Statystyki konsumenta.
+    alignas(64) clock::duration pop_wait{};
+
+public:
+    explicit spsc_ring(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    void push(T &&item)
+    {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) == slots.size())
+        {
+            auto start = clock::now();
+            while (t - head.load(memory_order_acquire) == slots.size())
+                this_thread::yield();
+            push_wait += clock::now() - start;
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, memory_order_release);
+
+        size_t depth = t + 1 - head.load(memory_order_relaxed);
+        max_depth = max(max_depth, depth);
+        depth_sum += depth;
+        pushes++;
+    }
+
+    void pop(T &item)
+    {
+        size_t h = head.load(memory_order_relaxed);
+        if (tail.load(memory_order_acquire) == h)
+        {
+            auto start = clock::now();
+            while (tail.load(memory_order_acquire) == h)
+                this_thread::yield();
+            pop_wait += clock::now() - start;
+        }
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return tail.load(memory_order_acquire) == head.load(memory_order_relaxed);
+    }
+
+    // Wypisanie statystyk kolejki (po zakończeniu obu stron).
+    void report(const char *name, ostream &stream) const
+    {
+        using ms = chrono::duration<double, milli>;
+        stream << "Queue " << name << ": capacity " << slots.size() << ", max depth "
+               << max_depth << ", mean depth " << fixed << setprecision(1)
+               << (pushes ? double(depth_sum) / pushes : 0.0) << ", producer stalled "
+               << ms(push_wait).count() << " ms, consumer waited "
+               << ms(pop_wait).count() << " ms" << endl;
+    }
+};
+
+// Linia rozpoznana przez etap analizy. Słowa zapisane są jako pozycje w tekście linii,
+//      bo przy wejściu niezmapowanym tekst jest kopiowany (bufor wejścia jest
+//      nadpisywany, zanim etap stanu skończy z linią).
+struct pipeline_record
+{
+    line_kind kind = LINE_END;
+    LL line = 0;
+    size_t offset = 0;
+    LL height = 0;
+    LL window = 0;
+    string_view view;           // Tekst linii w zmapowanym pliku.
+    string owned;               // Kopia tekstu linii z wejścia niezmapowanego.
+    size_t word_pos = 0, word_len = 0;
+    size_t road_pos = 0, road_len = 0;
+
+    string_view text() const
+    {
+        return owned.empty() ? view : string_view(owned);
+    }
+};
+
+// Tekst przeznaczony do wypisania przez etap wypisywania.
+struct pipeline_output
+{
+    bool end = false;
+    bool error = false;
+    string text;
+};
+
+void pipeline_parse(line_source &input, const options &opt, spsc_ring<pipeline_record> &records)
+{
+    LL line_counter = 0;
+    string_view line, index, car, road;
+    LL height = 0, window = 0;
+    while (input.next(line))
+    {
+        line_counter++;
+        line_kind kind = parse_line(line, line_counter, opt, index, car, road, height, window);
+        if (kind == LINE_EMPTY)
+            continue;
+
+        pipeline_record rec;
+        rec.kind = kind;
+        rec.line = line_counter;
+        rec.offset = input.offset();
+        rec.height = height;
+        rec.window = window;
+        rec.view = line;
+        if (input.mapped() == false)
+            rec.owned.assign(line);
+        string_view word = (kind == LINE_QUERY ? index : car);
+        if ((kind == LINE_QUERY || kind == LINE_INSERT) && word.empty() == false)
+        {
+            rec.word_pos = word.data() - line.data();
+            rec.word_len = word.length();
+        }
+        if (kind == LINE_INSERT)
+        {
+            rec.road_pos = road.data() - line.data();
+            rec.road_len = road.length();
+        }
+        records.push(std::move(rec));
+    }
+    pipeline_record end;
+    end.line = line_counter;
+    records.push(std::move(end));
+}
+
+void pipeline_apply(serial_engine &engine, spsc_ring<pipeline_record> &records,
+        spsc_ring<pipeline_output> &outputs, LL &line_count)
+{
+    pipeline_record rec;
+    string out, err;
+    while (true)
+    {
+        records.pop(rec);
+        if (rec.kind == LINE_END)
+            break;
+        string_view text = rec.text();
+        string_view word = text.substr(rec.word_pos, rec.word_len);
+        string_view road = text.substr(rec.road_pos, rec.road_len);
+        engine.apply(rec.kind, rec.line, text, rec.offset, word, word, road, rec.height,
+                rec.window, out, err);
+        if (err.empty() == false)
+            outputs.push({false, true, std::move(err)});
+        if (out.empty() == false)
+            outputs.push({false, false, std::move(out)});
+        err.clear();
+        out.clear();
+    }
+    line_count = rec.line;
+    outputs.push({true, false, {}});
+}
+
+// Wypisywanie zbiera teksty, dopóki kolejka nie opustoszeje, i wtedy zapisuje je naraz.
+void pipeline_write(spsc_ring<pipeline_output> &outputs)
+{
+    static constexpr size_t FLUSH_SIZE = 1 << 16;
+    pipeline_output item;
+    string out, err;
+    while (true)
+    {
+        outputs.pop(item);
+        if (item.end)
+            break;
+        (item.error ? err : out) += item.text;
+        if (outputs.empty() || out.size() + err.size() >= FLUSH_SIZE)
+        {
+            flush_output(err, cerr);
+            flush_output(out, cout);
+        }
+    }
+    flush_output(err, cerr);
+    flush_output(out, cout);
+}
+
+// Przetworzenie całego wejścia potokiem trzech wątków. Zwraca liczbę przetworzonych linii.
+LL process_pipeline(line_source &input, const options &opt)
+{
+    serial_engine engine(input, opt);
+    spsc_ring<pipeline_record> records(opt.queue_capacity);
+    spsc_ring<pipeline_output> outputs(opt.queue_capacity);
+    LL line_count = 0;
+
+    auto start = chrono::steady_clock::now();
+    thread parser(pipeline_parse, ref(input), cref(opt), ref(records));
+    thread writer(pipeline_write, ref(outputs));
+    pipeline_apply(engine, records, outputs, line_count);
+    parser.join();
+    writer.join();
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+    if (opt.print_stats)
+    {
+        cerr << "Peak retained pending bytes: " << engine.pending.peak_bytes() << endl;
+        cerr << "Pipeline: " << line_count << " lines in " << fixed << setprecision(1)
+             << elapsed.count() << " ms" << endl;
+        records.report("parse->apply", cerr);
+        outputs.report("apply->write", cerr);
+    }
+    return line_count;
+}
+
+/*
+ * Tryb wielowątkowy. Wejście czytane jest blokami pełnych linii. Każdy blok dzielony
+ * jest na granicach linii na kawałki analizowane równolegle, a rozpoznane wjazdy
+ * trafiają do shardów wyznaczonych przez hasz numeru auta. Każdy shard ma własną
+ * tablicę aut i częściowe sumy dróg, a wjazdy swoich aut przetwarza w kolejności
+ * linii. Zapytania nie zatrzymują shardów: każdy z nich w chwili zapytania zapisuje
+ * swoją część odpowiedzi, a krok scalający skleja części i razem z błędami wypisuje
+ * je w kolejności numerów linii, czyli dokładnie tak, jak wersja jednowątkowa.
+ */
+
+// Rozpoznana linia wejścia (wjazd, zapytanie albo błąd).
+struct parsed_line
+{
+    LL line;                // Numer linii w kawałku, liczony od 0.
+    string_view text;       // Cała linia.
+    string_view word;       // Numer auta albo identyfikator z zapytania.
+    string_view road;
+    LL height;
+};
+
+// Wynik analizy jednego kawałka bloku.
+struct chunk_result
+{
+    LL lines = 0;
+    vector<parsed_line> errors;
+    vector<parsed_line> queries;
+    vector<vector<parsed_line>> inserts;    // Wjazdy rozdzielone na shardy.
+};
+
+// Część odpowiedzi na zapytanie policzona przez jeden shard.
+struct query_part
+{
+    string cars;                        // Wypisane linie aut, posortowane po numerach.
+    vector<size_t> starts;              // Początki kolejnych linii w cars.
+    vector<pair<int, LL>> roads;        // Częściowe sumy dróg obecnych w shardzie.
+};
+
+// Shard stanu: auta o haszach numerów przypisanych do niego i ich wkład w sumy dróg.
+struct shard_state
+{
+    car_table cars;
+    road_table roads;
+    pending_store pending;
+    string errors;                                  // Treść błędów z bieżącego bloku.
+    vector<pair<LL, size_t>> error_ends;            // Linia wyzwalająca i koniec treści.
+    vector<query_part> answers;                     // Części odpowiedzi z bieżącego bloku.
+
+    explicit shard_state(const line_source &input) : pending(input) {}
+};
+
+inline size_t shard_of(string_view plate, size_t shards)
+{
+    return (car_table::hash(plate) >> 32) % shards;
+}
+
+// Analiza kawałka bloku zaczynającego się na granicy linii.
+void parse_chunk(string_view chunk, size_t shards, chunk_result &res)
+{
+    res.inserts.assign(shards, {});
+    string_view index, car, road;
+    LL height;
+    size_t pos = 0;
+    while (pos < chunk.length())
+    {
+        size_t nl = chunk.find('\n', pos);
+        size_t end = (nl == string_view::npos ? chunk.length() : nl);
+        string_view line = chunk.substr(pos, end - pos);
+        pos = end + 1;
+        LL number = res.lines++;
+        if (line.empty())
+            continue;
+
+        string_view line_cut = cut_blank_prefix(line);
+        if (analyse_line(line_cut, index, car, road, height))
+            res.errors.push_back({number, line, {}, {}, 0});
+        else if (line_cut[0] == QMARK)
+            res.queries.push_back({number, line, index, {}, 0});
+        else
+            res.inserts[shard_of(car, shards)].push_back({number, line, car, road, height});
+    }
+}
+
+// Zapisanie przez shard jego części odpowiedzi na zapytanie.
+void answer_part(shard_state &shard, string_view where, query_part &part)
+{
+    string &out = part.cars;
+    if (where == "")
+    {
+        for (uint32_t car : shard.cars.in_order())
+        {
+            if (shard.cars.seen[car] != 0)
+            {
+                part.starts.push_back(out.length());
+                print_car(shard.cars, car, out);
+            }
+        }
+        for (int road = 0; road < ROAD_COUNT; road++)
+        {
+            if (shard.roads.present[road])
+                part.roads.emplace_back(road, shard.roads.total[road]);
+        }
+    }
+    else
+    {
+        uint32_t car = shard.cars.find(where);
+        if (car_table::missing(car) == false)
+            print_car(shard.cars, car, out);
+        int road = road_lookup(where);
+        if (road >= 0 && shard.roads.present[road])
+            part.roads.emplace_back(road, shard.roads.total[road]);
+    }
+}
+
+// Przetworzenie przez shard jego wjazdów z bloku wraz z częściami odpowiedzi.
+void apply_shard(shard_state &shard, size_t index, const vector<chunk_result> &chunks,
+        const vector<LL> &first_line, const vector<parsed_line> &queries,
+        string_view block, size_t block_offset)
+{
+    shard.answers.assign(queries.size(), {});
+    size_t next_query = 0;
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+        for (const parsed_line &rec : chunks[c].inserts[index])
+        {
+            LL line = first_line[c] + rec.line;
+            while (next_query < queries.size() && queries[next_query].line < line)
+            {
+                answer_part(shard, queries[next_query].word, shard.answers[next_query]);
+                next_query++;
+            }
+            size_t before = shard.errors.length();
+            insert_data(line, rec.word, rec.road, rec.height, rec.text,
+                    block_offset + (rec.text.data() - block.data()),
+                    shard.cars, shard.roads, shard.pending, shard.errors);
+            if (shard.errors.length() != before)
+                shard.error_ends.emplace_back(line, shard.errors.length());
+        }
+    }
+    for (; next_query < queries.size(); next_query++)
+        answer_part(shard, queries[next_query].word, shard.answers[next_query]);
+}
+
+// Sklejenie części odpowiedzi shardów na zapytanie i wypisanie jej.
+void merge_answer(vector<shard_state> &shards, size_t q, string_view where, string &out)
+{
+    if (where == "")
+    {
+        // Scalanie posortowanych list aut z kolejnych shardów.
+        using cursor = pair<string_view, size_t>;
+        auto later = [](const cursor &a, const cursor &b) { return a.first > b.first; };
+        priority_queue<cursor, vector<cursor>, decltype(later)> heads(later);
+        vector<size_t> next(shards.size(), 0);
+        auto line_of = [&](size_t s, size_t i)
+        {
+            const query_part &part = shards[s].answers[q];
+            size_t end = (i + 1 < part.starts.size() ? part.starts[i + 1] : part.cars.length());
+            return string_view(part.cars).substr(part.starts[i], end - part.starts[i]);
+        };
+        for (size_t s = 0; s < shards.size(); s++)
+            if (shards[s].answers[q].starts.empty() == false)
+                heads.emplace(line_of(s, 0), s);
+        while (heads.empty() == false)
+        {
+            auto [line, s] = heads.top();
+            heads.pop();
+            out += line;
+            if (++next[s] < shards[s].answers[q].starts.size())
+                heads.emplace(line_of(s, next[s]), s);
+        }
+    }
+    else
+    {
+        for (shard_state &shard : shards)
+            out += shard.answers[q].cars;
+    }
+
+    array<LL, ROAD_COUNT> total{};
+    array<bool, ROAD_COUNT> present{};
+    for (shard_state &shard : shards)
+    {
+        for (auto [road, partial] : shard.answers[q].roads)
+        {
+            total[road] += partial;
+            present[road] = true;
+        }
+    }
+    char name[8];
+    for (int road = 0; road < ROAD_COUNT; road++)
+        if (present[road])
+            print_road(where == "" ? road_name(road, name) : where, total[road], out);
+}
+
+// Przetworzenie całego wejścia na opt.threads wątkach. Zwraca liczbę przetworzonych linii.
+LL process_parallel(line_source &input, const options &opt)
+{
+    static constexpr size_t PARALLEL_BLOCK = 1 << 26;
+
+    size_t threads = opt.threads;
+    vector<shard_state> shards;
+    for (size_t s = 0; s < threads; s++)
+        shards.emplace_back(input);
+
+    LL line_counter = 0;
+    string_view block;
+    size_t block_offset;
+    vector<chunk_result> chunks(threads);
+    vector<LL> first_line(threads);
+    vector<parsed_line> queries;
+    vector<thread> workers;
+    string out;
+
+    while (input.next_block(block, block_offset, PARALLEL_BLOCK))
+    {
+        // Podział bloku na kawałki kończące się znakiem nowej linii.
+        vector<string_view> parts;
+        size_t begin = 0;
+        for (size_t c = 1; c <= threads; c++)
+        {
+            size_t end = (c == threads ? block.length() : block.length() * c / threads);
+            if (end < begin)
+                end = begin;
+            size_t nl = block.find('\n', end == 0 ? 0 : end - 1);
+            end = (c == threads || nl == string_view::npos ? block.length() : nl + 1);
+            parts.push_back(block.substr(begin, end - begin));
+            begin = end;
+        }
+
+        for (size_t c = 0; c < threads; c++)
+        {
+            chunks[c] = chunk_result();
+            workers.emplace_back(parse_chunk, parts[c], threads, ref(chunks[c]));
+        }
+        for (thread &t : workers)
+            t.join();
+        workers.clear();
+
+        queries.clear();
+        for (size_t c = 0; c < threads; c++)
+        {
+            first_line[c] = line_counter + 1;
+            line_counter += chunks[c].lines;
+            for (parsed_line q : chunks[c].queries)
+            {
+                q.line += first_line[c];
+                queries.push_back(q);
+            }
+        }
+
+        for (size_t s = 0; s < threads; s++)
+            workers.emplace_back(apply_shard, ref(shards[s]), s, cref(chunks), cref(first_line),
+                    cref(queries), block, block_offset);
+        for (thread &t : workers)
+            t.join();
+        workers.clear();
+
+        // Błędy i odpowiedzi w kolejności numerów linii, które je wywołały.
+        vector<pair<LL, string_view>> errors;
+        for (size_t c = 0; c < threads; c++)
+            for (const parsed_line &e : chunks[c].errors)
+                errors.emplace_back(first_line[c] + e.line, e.text);
+        vector<string> shard_errors(threads);
+        for (size_t s = 0; s < threads; s++)
+        {
+            shard_errors[s] = shards[s].errors;
+            size_t begin = 0;
+            for (auto [line, end] : shards[s].error_ends)
+            {
+                errors.emplace_back(-line, string_view(shard_errors[s]).substr(begin, end - begin));
+                begin = end;
+            }
+            shards[s].errors.clear();
+            shards[s].error_ends.clear();
+        }
+        auto by_line = [](const pair<LL, string_view> &a, const pair<LL, string_view> &b)
+        {
+            return llabs(a.first) < llabs(b.first);
+        };
+        sort(errors.begin(), errors.end(), by_line);
+
+        size_t e = 0;
+        for (size_t q = 0; q <= queries.size(); q++)
+        {
+            LL until = (q < queries.size() ? queries[q].line : LLONG_MAX);
+            for (; e < errors.size() && llabs(errors[e].first) < until; e++)
+            {
+                // Ujemny numer oznacza gotowy komunikat shardu, dodatni - błędną linię.
+                if (errors[e].first < 0)
+                    cerr << errors[e].second;
+                else
+                    cerr << "Error in line " << errors[e].first << ": " << errors[e].second << endl;
+            }
+            if (q < queries.size())
+            {
+                merge_answer(shards, q, queries[q].word, out);
+                flush_output(out, cout);
+            }
+        }
+    }
+
+    if (opt.print_stats)
+    {
+        size_t peak = 0;
+        for (shard_state &shard : shards)
+            peak += shard.pending.peak_bytes();
+        cerr << "Peak retained pending bytes: " << peak << endl;
+    }
+    return line_counter;
+}
+
+LL process(line_source &input, const options &opt)
+{
+    if (opt.checkpoint.empty() == false)
+        return process_serial(input, opt);
+    if (opt.pipeline)
+        return process_pipeline(input, opt);
+    if (opt.threads > 1 && opt.delta == false && opt.window_lines == 0)
+        return process_parallel(input, opt);
+    return process_serial(input, opt);
+}
+
+/*
+ * Pomiary (-b). Wyniki wypisywane są na stdout jako JSON, żeby dało się śledzić
+ * regresje między wersjami. Dane wejściowe do pomiarów można wygenerować programem
+ * nod_gen.
+ */
+
+// Liczniki alokacji na stercie, zliczane przez globalny operator new tylko w trybie
+//      pomiarów (count_allocations ustawia bench). Każdy wątek zwiększa własny licznik
+//      w osobnej linii pamięci podręcznej, a odczyt sumuje wszystkie, więc wątki nie
+//      walczą o jeden licznik.
+constexpr int ALLOCATION_COUNTERS = 64;
+
+struct alignas(64) allocation_counter
+{
+    atomic<uint64_t> count{0};
+};
+
+bool count_allocations = false;
+allocation_counter allocation_counters[ALLOCATION_COUNTERS];
+atomic<int> next_allocation_counter{0};
+
+inline allocation_counter& thread_allocation_counter()
+{
+    static thread_local allocation_counter &counter = allocation_counters[
+            next_allocation_counter.fetch_add(1, memory_order_relaxed) % ALLOCATION_COUNTERS];
+    return counter;
+}
+
+// Liczba alokacji we wszystkich wątkach.
+uint64_t allocation_count()
+{
+    uint64_t total = 0;
+    for (const allocation_counter &counter : allocation_counters)
+        total += counter.count.load(memory_order_relaxed);
+    return total;
+}
+
+// Liczba alokacji w bieżącym wątku (dokładna, dopóki nie dzieli licznika z innym).
+uint64_t thread_allocation_count()
+{
+    return thread_allocation_counter().count.load(memory_order_relaxed);
+}
+
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    if (count_allocations)
+        thread_allocation_counter().count.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+[[gnu::noinline]] void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+[[gnu::noinline]] void operator delete[](void *memory) noexcept
+{
+    free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+[[gnu::noinline]] void operator delete[](void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+// Opóźnienia i alokacje jednej fazy przetwarzania linii.
+struct phase_stats
+{
+    vector<uint32_t> latencies;     // Czas każdej linii w nanosekundach.
+    uint64_t allocations = 0;
+
+    void add(chrono::steady_clock::duration elapsed, uint64_t allocated)
+    {
+        latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+        allocations += allocated;
+    }
+
+    uint32_t percentile(double p)
+    {
+        if (latencies.empty())
+            return 0;
+        size_t k = min(latencies.size() - 1, size_t(p * latencies.size()));
+        nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+        return latencies[k];
+    }
+
+    void write_json(const char *name, ostream &json)
+    {
+        json << "    \"" << name << "\": {\"lines\": " << latencies.size()
+             << ", \"p50_ns\": " << percentile(0.5) << ", \"p99_ns\": " << percentile(0.99)
+             << ", \"allocations\": " << allocations << "}";
+    }
+};
+
+// Szczytowe zużycie pamięci procesu w KiB.
+long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Czas przetworzenia całego pliku przy danych opcjach (wyjście programu jest pomijane).
+bool bench_run(const char *path, const options &opt, LL &lines, double &seconds)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    ofstream null_stream;
+    streambuf *out_buf = cout.rdbuf(null_stream.rdbuf());
+    streambuf *err_buf = cerr.rdbuf(null_stream.rdbuf());
+    auto start = chrono::steady_clock::now();
+    {
+        line_source input(fd);
+        lines = process(input, opt);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cout.rdbuf(out_buf);
+    cerr.rdbuf(err_buf);
+    close(fd);
+    seconds = elapsed.count();
+    return true;
+}
+
+// Przetworzenie pliku w jednym wątku z pomiarem każdej linii osobno w fazach: analiza,
+//      wjazd i zapytanie.
+void bench_phases(const char *path, const options &opt, ostream &json)
+{
+    using clock = chrono::steady_clock;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    phase_stats parse, apply, answer;
+    {
+        line_source input(fd);
+        serial_engine engine(input, opt);
+        string_view line, index, car, road;
+        LL height, window, line_counter = 0;
+        string out, err;
+        while (input.next(line))
+        {
+            line_counter++;
+            auto t0 = clock::now();
+            uint64_t a0 = thread_allocation_count();
+            line_kind kind = parse_line(line, line_counter, opt, index, car, road, height, window);
+            auto t1 = clock::now();
+            uint64_t a1 = thread_allocation_count();
+            engine.apply(kind, line_counter, line, input.offset(), index, car, road, height,
+                    window, out, err);
+            auto t2 = clock::now();
+            uint64_t a2 = thread_allocation_count();
+            out.clear();
+            err.clear();
+
+            parse.add(t1 - t0, a1 - a0);
+            if (kind == LINE_INSERT)
+                apply.add(t2 - t1, a2 - a1);
+            else if (kind == LINE_QUERY)
+                answer.add(t2 - t1, a2 - a1);
+        }
+    }
+    close(fd);
+
+    json << "  \"phases\": {\n";
+    parse.write_json("parse", json);
+    json << ",\n";
+    apply.write_json("insert", json);
+    json << ",\n";
+    answer.write_json("query", json);
+    json << "\n  },\n";
+}
+
+// Pomiar samej analizy linii z pliku dla każdej dostępnej wersji klasyfikacji.
+void bench_validator(const char *path, ostream &json)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    vector<string_view> lines;
+    line_source input(fd);
+    string_view line;
+    while (input.next(line))
+        if (input.mapped() && line.empty() == false)
+            lines.push_back(cut_blank_prefix(line));
+
+    json << "  \"validator\": [";
+    classify_fn chosen = classify_block;
+    const char *separator = "\n";
+    for (auto [name, variant] : classify_variants())
+    {
+        classify_block = variant;
+        string_view index, car, road;
+        LL height, accepted = 0;
+        auto start = chrono::steady_clock::now();
+        for (string_view cut : lines)
+            accepted += analyse_line(cut, index, car, road, height) == false;
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        json << separator << "    {\"kernel\": \"" << name << "\", \"lines\": " << lines.size()
+             << ", \"accepted\": " << accepted << ", \"lines_per_second\": " << fixed
+             << setprecision(0) << lines.size() / elapsed.count() << "}";
+        separator = ",\n";
+    }
+    json << "\n  ],\n";
+    classify_block = chosen;
+    close(fd);
+}
+
+// Pierwotne formatowanie liczby kilometrów (cyfry doklejane na początek napisu),
+//      zachowane do porównania z append_km w bench_dump.
+string int_to_string(LL x)
+{
+    string res = "";
+    res += (char)(x % 10 + '0');
+    res = ',' + res;
+    x /= 10;
+    if (x == 0)
+    {
+        res = '0' + res;
+    }
+    while (x != 0)
+    {
+        res = (char)(x % 10 + '0') + res;
+        x /= 10;
+    }
+    return res;
+}
+
+// Zrzut auta jak print_car, ale z sumami formatowanymi przez int_to_string.
+void print_car_int_to_string(const car_table &cars, uint32_t car, string &out)
+{
+    if (cars.seen[car] != 0)
+    {
+        out += cars.plate(car);
+        if (cars.seen[car] & 1)
+            out += " A " + int_to_string(cars.total_a[car]);
+        if (cars.seen[car] & 2)
+            out += " S " + int_to_string(cars.total_s[car]);
+        out += '\n';
+    }
+}
+
+// Pomiar renderowania pełnego zrzutu 1M aut z dużymi sumami: formatowanie przez
+//      append_km i dla porównania przez pierwotne int_to_string, na tych samych autach.
+void bench_dump(ostream &json)
+{
+    static constexpr int CARS = 1000000, ROUNDS = 5;
+    car_table cars;
+    mt19937_64 rng(418510);
+    char plate[12];
+    for (int i = 0; i < CARS; i++)
+    {
+        int length = snprintf(plate, sizeof(plate), "C%08d", i);
+        uint32_t car = cars.intern(string_view(plate, length));
+        cars.total_a[car] = rng() >> (1 + rng() % 63);
+        cars.total_s[car] = rng() >> (1 + rng() % 63);
+        cars.seen[car] = 1 + rng() % 3;
+    }
+    cars.in_order();
+
+    auto measure = [&](auto print, string &out)
+    {
+        auto start = chrono::steady_clock::now();
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            out.clear();
+            for (uint32_t car : cars.in_order())
+                print(cars, car, out);
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        return elapsed.count() / ROUNDS;
+    };
+    string out, old_out;
+    double seconds = measure([](const car_table &cars, uint32_t car, string &out)
+    {
+        print_car(cars, car, out);
+    }, out);
+    double old_seconds = measure(print_car_int_to_string, old_out);
+
+    json << "  \"dump\": {\"cars\": " << CARS << ", \"append_km_ms\": " << fixed
+         << setprecision(2) << seconds * 1000 << ", \"int_to_string_ms\": "
+         << old_seconds * 1000 << ", \"speedup\": " << old_seconds / seconds
+         << ", \"mb_per_second\": " << setprecision(1) << out.size() / seconds / 1e6
+         << ", \"same_output\": " << (out == old_out ? "true" : "false") << "},\n";
+}
+
+// Pełny zestaw pomiarów na podanym pliku: przepustowość trybu jednowątkowego, -j dla
+//      2, 4, 8 i 16 wątków oraz potoku, opóźnienia i alokacje faz, analiza linii
+//      każdą wersją klasyfikacji i renderowanie dużego zrzutu.
+int bench(const char *path, options opt)
+{
+    struct run { const char *mode; int threads; bool pipeline; };
+    const run runs[] = {{"serial", 1, false}, {"sharded", 2, false}, {"sharded", 4, false},
+                        {"sharded", 8, false}, {"sharded", 16, false}, {"pipeline", 3, true}};
+
+    count_allocations = true;
+    ostringstream json;
+    json << "{\n  \"input\": \"" << path << "\",\n  \"throughput\": [";
+    const char *separator = "\n";
+    for (const run &r : runs)
+    {
+        opt.threads = r.threads;
+        opt.pipeline = r.pipeline;
+        LL lines;
+        double seconds;
+        uint64_t allocated = allocation_count();
+        if (bench_run(path, opt, lines, seconds) == false)
+        {
+            cerr << "Cannot open " << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        allocated = allocation_count() - allocated;
+        json << separator << "    {\"mode\": \"" << r.mode << "\", \"threads\": " << r.threads
+             << ", \"lines\": " << lines << ", \"seconds\": " << fixed << setprecision(4)
+             << seconds << ", \"lines_per_second\": " << setprecision(0) << lines / seconds
+             << ", \"allocations\": " << allocated << "}";
+        separator = ",\n";
+    }
+    json << "\n  ],\n";
+
+    opt.threads = 1;
+    opt.pipeline = false;
+    bench_phases(path, opt, json);
+    bench_validator(path, json);
+    bench_dump(json);
+    json << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+    cout << json.str();
+    return 0;
+}
+
+// Wywołanie: nod [-s] [-j wątki] [-d] [-c plik [-n linie] [-t sekundy] [-r]]
+//              [-w linie [-W okna]] [-p [-q pojemność]] [-b] [plik].
+//      Bez podanego pliku dane czytane są ze standardowego wejścia. Opcja -s wypisuje
+//      na koniec statystyki zużycia pamięci na stderr, -j włącza przetwarzanie
+//      wielowątkowe, -d sprawia, że pełne zapytanie wypisuje tylko auta i drogi zmienione
+//      od poprzedniego pełnego zapytania, a -b mierzy przepustowość (wymaga pliku).
+//      Opcja -c zapisuje stan do pliku na koniec oraz co -n linii lub -t sekund,
+//      a -r wznawia przetwarzanie od miejsca zapisanego w tym pliku. Opcja -w liczy
+//      sumy także w oknach po podanej liczbie linii (pamiętanych jest ostatnich -W okien,
+//      domyślnie 24); zapytanie z końcowym słowem "@N" dotyczy okna N, a "@" bieżącego.
+//      Okien nie obejmuje zapis stanu. Opcja -p przetwarza wejście potokiem trzech
+//      wątków (analiza, stan, wypisywanie) z kolejkami o pojemności -q, a z -s wypisuje
+//      statystyki kolejek. Opcja -c wymusza przetwarzanie w jednym wątku, a -d i -w
+//      wyłączają tryb -j.
+int main(int argc, char *argv[])
+{
+    options opt;
+    int c;
+    while ((c = getopt(argc, argv, "sj:dc:n:t:rw:W:pq:b")) != -1)
+    {
+        if (c == 's')
+        {
+            opt.print_stats = true;
+        }
+        else if (c == 'j' && atoi(optarg) > 0)
+        {
+            opt.threads = atoi(optarg);
+        }
+        else if (c == 'd')
+        {
+            opt.delta = true;
+        }
+        else if (c == 'c')
+        {
+            opt.checkpoint = optarg;
+        }
+        else if (c == 'n' && atoll(optarg) > 0)
+        {
+            opt.checkpoint_lines = atoll(optarg);
+        }
+        else if (c == 't' && atof(optarg) > 0)
+        {
+            opt.checkpoint_seconds = atof(optarg);
+        }
+        else if (c == 'r')
+        {
+            opt.restore = true;
+        }
+        else if (c == 'w' && atoll(optarg) > 0)
+        {
+            opt.window_lines = atoll(optarg);
+        }
+        else if (c == 'W' && atoll(optarg) > 0)
+        {
+            opt.windows = atoll(optarg);
+        }
+        else if (c == 'p')
+        {
+            opt.pipeline = true;
+        }
+        else if (c == 'q' && atoll(optarg) > 0)
+        {
+            opt.queue_capacity = atoll(optarg);
+        }
+        else if (c == 'b')
+        {
+            opt.bench = true;
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [-s] [-j threads] [-d]"
+                 << " [-c checkpoint [-n lines] [-t seconds] [-r]]"
+                 << " [-w lines [-W windows]] [-p [-q capacity]] [-b] [file]" << endl;
+            return 1;
+        }
+    }
+
+    if (opt.checkpoint.empty() && (opt.restore || opt.checkpoint_lines || opt.checkpoint_seconds))
+    {
+        cerr << "Options -n, -t and -r require a checkpoint file (-c)" << endl;
+        return 1;
+    }
+
+    if (opt.bench)
+    {
+        if (optind >= argc)
+        {
+            cerr << "Benchmark mode requires an input file" << endl;
+            return 1;
+        }
+        return bench(argv[optind], opt);
+    }
+
+    int input_fd = STDIN_FILENO;
+    if (optind < argc)
+    {
+        input_fd = open(argv[optind], O_RDONLY);
+        if (input_fd < 0)
+        {
+            cerr << "Cannot open " << argv[optind] << ": " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+
+    LL processed;
+    {
+        line_source input(input_fd);
+        processed = process(input, opt);
+    }
+    if (input_fd != STDIN_FILENO)
+        close(input_fd);
+    return processed < 0 ? 1 : 0;
+}
@@ -0,0 +1,388 @@
+/********************************
+ * Kamil Zwierzchowski (418510) *
+ * & Grzegorz Zaleski (418494)  *
+ ********************************/
+
+// Różnicowy test klasyfikacji linii nod: każda wersja klasyfikacji (skalarna, SSE2,
+//      AVX2) porównywana jest z pierwotną analizą linii opartą o isspace/isalpha/isdigit
+//      na losowych i zmutowanych liniach. Kompilacja: g++ -O2 -std=c++17 nod_fuzz.cc
+//      (nod.cc dołączany jest w całości, jego main przemianowany na nod_main).
+
+#define main nod_main
+#include "nod.cc"
+#undef main
+
+namespace reference
+{
+
+// Poniższe funkcje to analiza linii sprzed klasyfikacji na maskach bitowych,
+//      różniąca się tylko tym, że wysokość liczona jest bez znaku (bez przepełnienia LL).
+
+bool wrong_road(string &potential_road)
+{
+    if (potential_road.length() < 2 || potential_road.length() > 4)
+        return true;
+
+    if (potential_road[0] != 'S' && potential_road[0] != 'A')
+        return true;
+
+    for (size_t i=1; i<potential_road.length(); ++i)
+        if (isdigit(potential_road[i]) == false)
+            return true;
+
+    if (potential_road[1] == '0')
+        return true;
+
+    return false;
+}
+
+bool wrong_car(string &potential_car)
+{
+    if (potential_car.length() < 3 || potential_car.length() > 11)
+        return true;
+
+    for (auto sign:potential_car)
+        if (isalpha(sign) == false && isdigit(sign) == false)
+            return true;
+
+    return false;
+}
+
+bool analyse_query(string &line, string &index)
+{
+    size_t i = 1;
+    while (i < line.length() && isspace(line[i]))
+        i++;
+
+    index = "";
+    while (i < line.length() && isspace(line[i]) == false)
+    {
+        index += line[i];
+        i++;
+    }
+
+    while (i < line.length() && isspace(line[i]))
+        i++;
+
+    return i != line.length() || (wrong_road(index) && wrong_car(index) && index != "");
+}
+
+bool wrong_height(LL &height, string height_str)
+{
+    if (height_str.length() < 3)
+        return true;
+
+    if (height_str[height_str.length() - 2] != ',')
+        return true;
+
+    if (height_str[0] == '0' && height_str[1] != ',')
+        return true;
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < height_str.length(); ++i)
+    {
+        if (isdigit(height_str[i]) == false)
+        {
+            if (i != (height_str.length() - 2) || height_str[i] != ',')
+                return true;
+        }
+        else
+        {
+            value = value*10 + (height_str[i] - '0');
+        }
+    }
+
+    height = value;
+    return false;
+}
+
+string cut_blank_prefix(string line)
+{
+    string res = "";
+    size_t i = 0;
+    while (i < line.length() && isspace(line[i]))
+        i++;
+    while (i < line.length())
+        res += line[i++];
+    return res;
+}
+
+bool analyse_data_insertion(string &line, string &car, string &road, LL &height)
+{
+    size_t i = 0;
+    while (i < line.length() && isspace(line[i]))
+        i++;
+
+    car = "";
+    while (i < line.length() && isspace(line[i]) == false)
+    {
+        car += line[i];
+        i++;
+    }
+
+    while (i < line.length() && isspace(line[i]))
+        i++;
+
+    road = "";
+    while (i < line.length() && isspace(line[i]) == false)
+    {
+        road += line[i];
+        i++;
+    }
+
+    while (i < line.length() && isspace(line[i]))
+        i++;
+
+    string height_str = "";
+    while (i < line.length() && isspace(line[i]) == false)
+    {
+        height_str += line[i];
+        i++;
+    }
+
+    while (i < line.length() && isspace(line[i]))
+        i++;
+
+    return i != line.length() || wrong_car(car) || wrong_road(road) || wrong_height(height, height_str);
+}
+
+bool analyse_line(string &line, string &index, string &car, string &road, LL &height)
+{
+    if (line[0] == QMARK)
+        return analyse_query(line, index);
+    else
+        return analyse_data_insertion(line, car, road, height);
+}
+
+// Rozpoznanie niepustej linii tak jak w pierwotnej pętli głównej.
+line_kind parse(const string &line, string &index, string &car, string &road, LL &height)
+{
+    string line_cut = cut_blank_prefix(line);
+    if (analyse_line(line_cut, index, car, road, height))
+        return LINE_ERROR;
+    return line_cut[0] == QMARK ? LINE_QUERY : LINE_INSERT;
+}
+
+}
+
+// Ustawienia testu z linii poleceń.
+struct fuzz_options
+{
+    LL lines = 1000000;             // -n N: liczba linii na każdą wersję klasyfikacji.
+    uint64_t seed = 418510;         // -s N: ziarno generatora liczb losowych.
+};
+
+// Generator linii: losowe znaki ze słownika "ciekawych" znaków i pełnego zakresu
+//      bajtów oraz mutacje poprawnych linii, o długościach z obu stron LINE_BLOCK.
+class line_generator
+{
+    mt19937_64 rng;
+
+    static constexpr char INTERESTING[] = "?AS0123456789,,  \t\v\f\r\x01\x7f\x80\xa0\xff"
+            "aszZ_.-";
+
+    char any_char()
+    {
+        char c = char(rng() % 256);
+        switch (rng() % 4)
+        {
+            case 0:
+                return c == '\n' ? ' ' : c;
+            case 1:
+                return "0123456789"[rng() % 10];
+            default:
+                return INTERESTING[rng() % (sizeof(INTERESTING) - 1)];
+        }
+    }
+
+    string word(size_t min_length, size_t max_length, const char *alphabet)
+    {
+        size_t length = min_length + rng() % (max_length - min_length + 1);
+        size_t size = strlen(alphabet);
+        string res;
+        for (size_t i = 0; i < length; i++)
+            res += alphabet[rng() % size];
+        return res;
+    }
+
+    string blanks(size_t max_length)
+    {
+        return word(1, max_length, " \t\v\f\r");
+    }
+
+    string valid_line()
+    {
+        const char *alnum = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+        string road = string(1, "AS"[rng() % 2]) + char('1' + rng() % 9) + word(0, 2, "0123456789");
+        if (rng() % 3 == 0)
+        {
+            string res = rng() % 2 ? "" : blanks(70);
+            res += '?';
+            if (rng() % 4 != 0)
+                res += (rng() % 2 ? "" : blanks(70)) + (rng() % 2 ? road : word(3, 11, alnum));
+            if (rng() % 2)
+                res += blanks(70);
+            return res;
+        }
+        string height = rng() % 8 == 0 ? "0" : char('1' + rng() % 9) + word(0, 17, "0123456789");
+        string res = rng() % 2 ? "" : blanks(40);
+        res += word(3, 11, alnum) + blanks(20) + road + blanks(20)
+                + height + ',' + char('0' + rng() % 10);
+        if (rng() % 2)
+            res += blanks(40);
+        return res;
+    }
+
+public:
+    explicit line_generator(uint64_t seed) : rng(seed) {}
+
+    string next()
+    {
+        string line;
+        if (rng() % 2)
+        {
+            size_t length = rng() % (2 * LINE_BLOCK + 8);
+            for (size_t i = 0; i < length; i++)
+                line += any_char();
+            return line;
+        }
+
+        line = valid_line();
+        size_t mutations = rng() % 3;
+        for (size_t i = 0; i < mutations && line.empty() == false; i++)
+        {
+            size_t pos = rng() % line.length();
+            switch (rng() % 3)
+            {
+                case 0:
+                    line[pos] = any_char();
+                    break;
+                case 1:
+                    line.insert(line.begin() + pos, any_char());
+                    break;
+                default:
+                    line.erase(pos, 1);
+                    break;
+            }
+        }
+        return line;
+    }
+
+    // Blok LINE_BLOCK losowych bajtów (także '\n' i bajty spoza ASCII).
+    void block(char *out)
+    {
+        for (size_t i = 0; i < LINE_BLOCK; i++)
+            out[i] = rng() % 2 ? char(rng() % 256) : any_char();
+    }
+};
+
+// Wypisanie linii z niewidocznymi znakami w postaci szesnastkowej.
+string escaped(const string &line)
+{
+    string res;
+    char buf[8];
+    for (unsigned char c : line)
+    {
+        if (c >= 0x20 && c < 0x7f && c != '\\')
+            res += char(c);
+        else
+        {
+            snprintf(buf, sizeof(buf), "\\x%02x", c);
+            res += buf;
+        }
+    }
+    return res;
+}
+
+// Porównanie masek jednej wersji klasyfikacji z isspace/isdigit/isalnum.
+bool check_masks(const char *name, classify_fn classify, const char *block)
+{
+    char_masks m = classify(block);
+    for (size_t i = 0; i < LINE_BLOCK; i++)
+    {
+        bool blank = isspace(block[i]), digit = isdigit(block[i]),
+                alnum = isalpha(block[i]) || isdigit(block[i]);
+        if (((m.blank >> i) & 1) != blank || ((m.digit >> i) & 1) != digit
+                || ((m.alnum >> i) & 1) != alnum)
+        {
+            cerr << name << ": wrong class of byte " << int((unsigned char)block[i])
+                 << " at position " << i << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Porównanie rozpoznania jednej linii z pierwotną analizą (true = zgodne).
+bool check_line(const char *name, const string &line)
+{
+    options opt;
+    string_view index, car, road;
+    LL height = 0, window;
+    line_kind kind = parse_line(line, 1, opt, index, car, road, height, window);
+
+    string ref_index, ref_car, ref_road;
+    LL ref_height = 0;
+    line_kind ref_kind = line.empty() ? LINE_EMPTY
+            : reference::parse(line, ref_index, ref_car, ref_road, ref_height);
+
+    bool same = kind == ref_kind;
+    if (same && kind == LINE_QUERY)
+        same = index == ref_index;
+    if (same && kind == LINE_INSERT)
+        same = car == ref_car && road == ref_road && height == ref_height;
+    if (same == false)
+        cerr << name << ": mismatch (kind " << int(kind) << ", expected " << int(ref_kind)
+             << ") on line \"" << escaped(line) << "\"" << endl;
+    return same;
+}
+
+// Wywołanie: nod_fuzz [-n linie] [-s ziarno].
+//      Dla każdej wersji klasyfikacji dostępnej na tym procesorze sprawdza maski na
+//      losowych blokach i rozpoznanie linii na tych samych losowych liniach. Kończy się
+//      kodem 1 przy pierwszej niezgodności.
+int main(int argc, char *argv[])
+{
+    fuzz_options opt;
+    int c;
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+    {
+        if (c == 'n' && atoll(optarg) >= 0)
+        {
+            opt.lines = atoll(optarg);
+        }
+        else if (c == 's')
+        {
+            opt.seed = strtoull(optarg, nullptr, 10);
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [-n lines] [-s seed]" << endl;
+            return 1;
+        }
+    }
+
+    for (auto [name, classify] : classify_variants())
+    {
+        classify_block = classify;
+        line_generator gen(opt.seed);
+        alignas(64) char block[LINE_BLOCK];
+
+        for (int c = 0; c < 256; c++)
+        {
+            memset(block, c, LINE_BLOCK);
+            if (check_masks(name, classify, block) == false)
+                return 1;
+        }
+        for (LL i = 0; i < opt.lines; i++)
+        {
+            gen.block(block);
+            if (check_masks(name, classify, block) == false)
+                return 1;
+            if (check_line(name, gen.next()) == false)
+                return 1;
+        }
+        cout << name << ": " << opt.lines << " lines OK" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+/********************************
+ * Kamil Zwierzchowski (418510) *
+ * & Grzegorz Zaleski (418494)  *
+ ********************************/
+
+#include <iostream>
+#include <bits/stdc++.h>
+#include <unistd.h>
+
+using namespace std;
+using LL = long long;
+
+// Ustawienia generatora z linii poleceń.
+struct options
+{
+    LL lines = 1000000;             // -n N: liczba linii.
+    LL cars = 10000;                // -c N: liczba różnych aut (najwyżej 10^9).
+    int roads = 200;                // -r N: liczba różnych dróg (najwyżej 1998).
+    double error_rate = 0.01;       // -e P: odsetek błędnych linii.
+    double query_rate = 0.01;       // -q P: odsetek zapytań.
+    double zipf = 1.0;              // -z S: wykładnik rozkładu Zipfa dla aut i dróg.
+    uint64_t seed = 418510;         // -s N: ziarno generatora liczb losowych.
+};
+
+// Losowanie indeksów 0..n-1 z rozkładem Zipfa o wykładniku s (dla s = 0 jednostajnie).
+class zipf_distribution
+{
+    vector<double> cumulative;
+
+public:
+    zipf_distribution(size_t n, double s) : cumulative(n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            sum += 1 / pow(double(i + 1), s);
+            cumulative[i] = sum;
+        }
+    }
+
+    template <typename Rng>
+    size_t operator()(Rng &rng)
+    {
+        double x = uniform_real_distribution<double>(0, cumulative.back())(rng);
+        size_t i = upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin();
+        return min(i, cumulative.size() - 1);
+    }
+};
+
+// Poprawny, unikalny numer rejestracyjny auta o numerze i (od 3 do 11 znaków).
+//      Losowy przedrostek składa się z samych liter, więc numer i zaczyna się na
+//      pierwszej cyfrze i różne auta nie mogą dostać tego samego numeru.
+string make_plate(LL i, mt19937_64 &rng)
+{
+    static constexpr char LETTERS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    string number = to_string(i);
+    string plate(2 + rng() % (10 - number.size()), ' ');
+    for (char &c : plate)
+        c = LETTERS[rng() % 26];
+    return plate + number;
+}
+
+// Nazwy dróg: kolejno A1, S1, A2, S2, ...
+vector<string> make_roads(int count)
+{
+    vector<string> roads;
+    for (int i = 0; i < count; i++)
+        roads.push_back(string(1, i % 2 ? 'S' : 'A') + to_string(i / 2 + 1));
+    return roads;
+}
+
+// Linia z błędem jednego z kilku rodzajów.
+void append_error(string &out, const string &plate, const string &road, mt19937_64 &rng)
+{
+    switch (rng() % 6)
+    {
+        case 0:
+            out += plate + " B" + road.substr(1) + " 1,0";
+            break;
+        case 1:
+            out += plate + " " + road + " 12";
+            break;
+        case 2:
+            out += plate + " " + road + " 1,23";
+            break;
+        case 3:
+            out += "x " + road + " 3,1";
+            break;
+        case 4:
+            out += plate + " " + road[0] + "0" + road.substr(1) + " 7,5";
+            break;
+        default:
+            out += "? " + plate + " " + road;
+            break;
+    }
+}
+
+// Wygenerowanie danych wejściowych dla nod na standardowe wyjście.
+void generate(const options &opt)
+{
+    mt19937_64 rng(opt.seed);
+    vector<string> plates;
+    for (LL i = 0; i < opt.cars; i++)
+        plates.push_back(make_plate(i, rng));
+    vector<string> roads = make_roads(opt.roads);
+    zipf_distribution pick_car(plates.size(), opt.zipf), pick_road(roads.size(), opt.zipf);
+    uniform_real_distribution<double> coin(0, 1);
+    vector<int> on_road(plates.size(), -1);
+
+    string out;
+    for (LL line = 0; line < opt.lines; line++)
+    {
+        size_t car = pick_car(rng);
+        const string &plate = plates[car];
+        const string &road = roads[on_road[car] < 0 ? pick_road(rng) : on_road[car]];
+        double kind = coin(rng);
+        if (kind < opt.error_rate)
+        {
+            append_error(out, plate, road, rng);
+        }
+        else if (kind < opt.error_rate + opt.query_rate)
+        {
+            uint64_t target = rng() % 8;
+            if (target == 0)
+                out += "?";
+            else if (target < 5)
+                out += "? " + plate;
+            else
+                out += "? " + road;
+        }
+        else
+        {
+            // Auto na drodze z niej zjeżdża, a pozostałe wjeżdżają na wylosowaną.
+            on_road[car] = on_road[car] < 0 ? &road - roads.data() : -1;
+            out += plate + " " + road + " " + to_string(rng() % 1000) + "," + to_string(rng() % 10);
+        }
+        out += '\n';
+
+        if (out.size() >= (1 << 20))
+        {
+            cout.write(out.data(), out.size());
+            out.clear();
+        }
+    }
+    cout.write(out.data(), out.size());
+}
+
+// Wywołanie: nod_gen [-n linie] [-c auta] [-r drogi] [-e błędy] [-q zapytania]
+//              [-z wykładnik] [-s ziarno].
+//      Wypisuje na standardowe wyjście deterministyczne (dla danego ziarna) dane
+//      wejściowe dla nod do pomiarów wydajności. Auta i drogi losowane są z rozkładem
+//      Zipfa o podanym wykładniku, a -e i -q to odsetki linii błędnych i zapytań.
+int main(int argc, char *argv[])
+{
+    ios_base::sync_with_stdio(false);
+    options opt;
+    int c;
+    while ((c = getopt(argc, argv, "n:c:r:e:q:z:s:")) != -1)
+    {
+        if (c == 'n' && atoll(optarg) >= 0)
+        {
+            opt.lines = atoll(optarg);
+        }
+        else if (c == 'c' && atoll(optarg) > 0 && atoll(optarg) <= 1000000000)
+        {
+            opt.cars = atoll(optarg);
+        }
+        else if (c == 'r' && atoi(optarg) > 0 && atoi(optarg) <= 1998)
+        {
+            opt.roads = atoi(optarg);
+        }
+        else if (c == 'e' && atof(optarg) >= 0 && atof(optarg) <= 1)
+        {
+            opt.error_rate = atof(optarg);
+        }
+        else if (c == 'q' && atof(optarg) >= 0 && atof(optarg) <= 1)
+        {
+            opt.query_rate = atof(optarg);
+        }
+        else if (c == 'z' && atof(optarg) >= 0)
+        {
+            opt.zipf = atof(optarg);
+        }
+        else if (c == 's')
+        {
+            opt.seed = strtoull(optarg, nullptr, 10);
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [-n lines] [-c cars] [-r roads] [-e error_rate]"
+                 << " [-q query_rate] [-z zipf] [-s seed]" << endl;
+            return 1;
+        }
+    }
+
+    if (opt.error_rate + opt.query_rate > 1)
+    {
+        cerr << "Error rate and query rate must sum to at most 1" << endl;
+        return 1;
+    }
+
+    generate(opt);
+    return 0;
+}
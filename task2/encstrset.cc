@@ -1,51 +1,958 @@
 // Authors: Kamil Zwierzchowski and Szymon Czyżmański
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
 #include <string>
-#include <unordered_set>
-#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "encstrset.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ENCSTRSET_X86
+#endif
+
 #ifdef NDEBUG
 static constexpr bool debug = false;
 #else
 static constexpr bool debug = true;
 #endif
 
+#ifdef ENCSTRSET_NO_TRACE
+static constexpr bool tracing = false;
+#else
+static constexpr bool tracing = true;
+#endif
+
 using std::endl;
 using std::string;
+using std::string_view;
 using std::stringstream;
 
 namespace {
     /**
-     * Funtion used to perform operation on set with given id.
+     * Number of independently locked stripes each set is split into.
      */
-    using set_func_t = void (*)(unsigned long);
+    constexpr size_t stripe_count = 16;
     /**
-     * Function used to perform operation on passed encrypted value and set with
-     * given id.
+     * Number of bits of set identifier selecting slot within registry chunk.
      */
-    using val_func_t = void (*)(unsigned long, const string &);
+    constexpr unsigned long chunk_bits = 12;
     /**
-     * Unordered set storing @p string objects representing encrypted values.
+     * Number of registry chunks. Registry holds up to
+     * @p chunk_count << @p chunk_bits sets.
      */
-    using enc_set_t = std::unordered_set<string>;
+    constexpr unsigned long chunk_count = 1ul << 20;
     /**
-     * Unordered map storing @p enc_set_t objects by their ids.
+     * Number of bytes XOR-ed at once by the widest encryption kernel.
      */
-    using id_to_enc_set_t = std::unordered_map<unsigned long, enc_set_t>;
+    constexpr size_t xor_block = 64;
     /**
-     * Pair storing @p string objects, representing diagnostic messages
-     * printed if debug mode is on.
+     * Number of most recent operations kept in the trace, a power of two.
+     */
+    constexpr uint64_t trace_capacity = 1ul << 16;
+    /**
+     * Default number of values in both sets from which operations combining
+     * them are performed by multiple threads.
+     */
+    constexpr size_t parallel_values = 1 << 16;
+    /**
+     * Largest allowed number of filter bits per value.
+     */
+    constexpr unsigned max_filter_bits = 64;
+
+    /**
+     * Encrypted value together with its hash, computed once per operation.
+     */
+    struct enc_value_t {
+        string value;
+        size_t hash;
+    };
+
+    /** @brief Length of value stored in arena record.
+     * @param record - record holding value length followed by its bytes.
+     * @return Length of value held in the record.
+     */
+    inline uint32_t record_length(const char *record) {
+        uint32_t length;
+        memcpy(&length, record, sizeof(length));
+        return length;
+    }
+
+    /** @brief Bytes of value stored in arena record.
+     * @param record - record holding value length followed by its bytes.
+     * @return Pointer to the first byte of value held in the record.
+     */
+    inline const char *record_data(const char *record) {
+        return record + sizeof(uint32_t);
+    }
+
+    /**
+     * Bump allocator of records holding length-prefixed values in a single
+     * buffer growing geometrically. Records are addressed by offsets, so the
+     * buffer may be moved when it grows and stored in a file as it is. They
+     * are never freed one by one; space of erased values is reclaimed when
+     * table is rebuilt.
+     */
+    class arena_t {
+        static constexpr size_t min_size = 256;
+
+        std::unique_ptr<char[]> bytes;
+        size_t used = 0;
+        size_t reserved = 0;
+
+    public:
+        /** @brief Store value in a new record.
+         * @param data - bytes of value.
+         * @param length - length of value.
+         * @return Offset of record holding the value.
+         */
+        size_t add(const char *data, uint32_t length) {
+            size_t needed = sizeof(length) + length;
+            if (needed > reserved - used) {
+                size_t size = std::max(std::max(min_size, 2 * reserved), used + needed);
+                std::unique_ptr<char[]> grown(new char[size]);
+                if (used > 0) {
+                    memcpy(grown.get(), bytes.get(), used);
+                }
+                bytes = std::move(grown);
+                reserved = size;
+            }
+
+            size_t record = used;
+            memcpy(bytes.get() + record, &length, sizeof(length));
+            memcpy(bytes.get() + record + sizeof(length), data, length);
+            used += needed;
+            return record;
+        }
+
+        /** @brief Buffer holding the records.
+         */
+        const char *data() const {
+            return bytes.get();
+        }
+
+        /** @brief Number of bytes taken by records, including erased ones.
+         */
+        size_t used_bytes() const {
+            return used;
+        }
+
+        /** @brief Number of bytes of the allocated buffer.
+         */
+        size_t reserved_bytes() const {
+            return reserved;
+        }
+    };
+
+    /**
+     * Slot of @p flat_table_t: hash of the value and offset of its record
+     * in the arena.
+     */
+    struct flat_slot_t {
+        size_t hash;
+        size_t record;
+    };
+
+    /**
+     * Arrays of a table stored in a file: @p capacity control bytes,
+     * @p capacity slots and @p records_bytes of records, together with
+     * counters of the table. Arrays live in a mapping of the file kept alive
+     * by @p mapping.
+     */
+    struct mapped_table_t {
+        const int8_t *ctrl;
+        const flat_slot_t *slots;
+        const char *records;
+        size_t capacity;
+        size_t count;
+        size_t tombstones;
+        size_t live_bytes;
+        size_t records_bytes;
+        std::shared_ptr<const void> mapping;
+    };
+
+    /**
+     * Memory usage and shape of a table: bytes of stored values, bytes taken
+     * by everything else, number of slots and the largest number of groups
+     * probed to find a stored value.
+     */
+    struct table_stats_t {
+        size_t payload_bytes;
+        size_t overhead_bytes;
+        size_t capacity;
+        size_t longest_probe;
+    };
+
+    /**
+     * Open-addressing hash set of encrypted values in the style of Swiss tables.
+     * Each slot has a control byte: @p empty, @p deleted or 7 bits of hash of
+     * the value held in it. Slots are probed in aligned groups of @p group_width,
+     * comparing all control bytes of a group at once, and a lookup ends at the
+     * first group with an empty slot. Groups are visited in triangular order,
+     * which covers all of them as their number is a power of two. Hashes are
+     * stored, so values never need hashing again, and values themselves live
+     * in the table arena.
+     * Table may instead serve its arrays from a mapped file. Such table is
+     * never modified; it is copied into an owned one first.
+     */
+    class flat_table_t {
+        static constexpr size_t group_width = 16;
+        static constexpr int8_t empty = -128;
+        static constexpr int8_t deleted = -2;
+        static constexpr size_t npos = SIZE_MAX;
+        // Bytes of erased records tolerated in the arena regardless of live ones.
+        static constexpr size_t min_dead_bytes = 4096;
+
+        // Arrays used by lookups, either owned or mapped.
+        int8_t *ctrl = nullptr;
+        flat_slot_t *slots = nullptr;
+        const char *records = nullptr;
+        size_t capacity = 0;
+        size_t count = 0;
+        size_t tombstones = 0;
+        size_t live_bytes = 0;
+        std::unique_ptr<int8_t[]> ctrl_storage;
+        std::unique_ptr<flat_slot_t[]> slot_storage;
+        arena_t arena;
+        std::shared_ptr<const void> mapping;
+        size_t mapped_bytes = 0;
+
+        /** @brief Control byte of value with given hash.
+         * Low 7 bits of hash are used; bits above them choose stripe and group.
+         */
+        static int8_t h2(const size_t hash) {
+            return static_cast<int8_t>(hash & 0x7F);
+        }
+
+        size_t first_group(const size_t hash) const {
+            return (hash >> 11) & (capacity / group_width - 1);
+        }
+
+        /** @brief Bit mask of slots in given group whose control byte is @p c.
+         */
+        uint32_t match(const size_t group, const int8_t c) const {
+            const int8_t *bytes = ctrl + group * group_width;
+#ifdef __SSE2__
+            __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(c)));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < group_width; i++) {
+                mask |= uint32_t(bytes[i] == c) << i;
+            }
+            return mask;
+#endif
+        }
+
+        /** @brief Bit mask of empty or deleted slots in given group.
+         */
+        uint32_t match_free(const size_t group) const {
+            const int8_t *bytes = ctrl + group * group_width;
+#ifdef __SSE2__
+            return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes)));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < group_width; i++) {
+                mask |= uint32_t(bytes[i] < 0) << i;
+            }
+            return mask;
+#endif
+        }
+
+        bool holds(const flat_slot_t &slot, const char *data, const size_t length,
+                   const size_t hash) const {
+            return slot.hash == hash && record_length(records + slot.record) == length &&
+                   memcmp(record_data(records + slot.record), data, length) == 0;
+        }
+
+        /** @brief Find slot holding given value.
+         * @return Index of slot holding given value or @p npos.
+         */
+        size_t locate(const char *data, const size_t length, const size_t hash) const {
+            if (capacity == 0) {
+                return npos;
+            }
+
+            size_t group = first_group(hash);
+            for (size_t step = 1;; step++) {
+                for (uint32_t mask = match(group, h2(hash)); mask != 0; mask &= mask - 1) {
+                    size_t i = group * group_width + __builtin_ctz(mask);
+                    if (holds(slots[i], data, length, hash)) {
+                        return i;
+                    }
+                }
+                if (match(group, empty) != 0) {
+                    return npos;
+                }
+                group = (group + step) & (capacity / group_width - 1);
+            }
+        }
+
+        /** @brief Find first empty or deleted slot on probe sequence of hash.
+         */
+        size_t free_slot(const size_t hash) const {
+            size_t group = first_group(hash);
+            for (size_t step = 1;; step++) {
+                uint32_t mask = match_free(group);
+                if (mask != 0) {
+                    return group * group_width + __builtin_ctz(mask);
+                }
+                group = (group + step) & (capacity / group_width - 1);
+            }
+        }
+
+        /** @brief Store value in the arena.
+         * @return Offset of record holding the value.
+         */
+        size_t add_record(const char *data, const uint32_t length) {
+            size_t record = arena.add(data, length);
+            records = arena.data();
+            return record;
+        }
+
+        /** @brief Rebuild table with given number of slots.
+         * Tombstones are dropped. Arena is compacted if erased values take
+         * more space than live ones.
+         * @param new_capacity - power of two not less than @p group_width.
+         */
+        void rehash(const size_t new_capacity) {
+            std::unique_ptr<int8_t[]> old_ctrl = std::move(ctrl_storage);
+            std::unique_ptr<flat_slot_t[]> old_slots = std::move(slot_storage);
+            size_t old_capacity = capacity;
+
+            ctrl_storage.reset(new int8_t[new_capacity]);
+            std::fill(ctrl_storage.get(), ctrl_storage.get() + new_capacity, empty);
+            slot_storage.reset(new flat_slot_t[new_capacity]);
+            ctrl = ctrl_storage.get();
+            slots = slot_storage.get();
+            capacity = new_capacity;
+            tombstones = 0;
+
+            arena_t old_arena;
+            bool compact = arena.used_bytes() > 2 * live_bytes;
+            if (compact) {
+                std::swap(arena, old_arena);
+            }
+
+            for (size_t i = 0; i < old_capacity; i++) {
+                if (old_ctrl[i] >= 0) {
+                    flat_slot_t slot = old_slots[i];
+                    if (compact) {
+                        const char *record = old_arena.data() + slot.record;
+                        slot.record = add_record(record_data(record),
+                                                 record_length(record));
+                    }
+                    size_t j = free_slot(slot.hash);
+                    ctrl[j] = h2(slot.hash);
+                    slots[j] = slot;
+                }
+            }
+        }
+
+        /** @brief Smallest allowed number of slots holding given number of values.
+         */
+        static size_t capacity_for(const size_t values) {
+            size_t capacity = group_width;
+            while (capacity * 7 < values * 8) {
+                capacity *= 2;
+            }
+            return capacity;
+        }
+
+    public:
+        flat_table_t() = default;
+        flat_table_t(flat_table_t &&) = default;
+        flat_table_t &operator=(flat_table_t &&) = default;
+        flat_table_t &operator=(const flat_table_t &) = delete;
+
+        /** @brief Create copy of given table with its own compacted arena.
+         */
+        flat_table_t(const flat_table_t &other) {
+            reserve(other.count);
+            other.for_each([this](const char *data, uint32_t length, size_t hash) {
+                insert_absent(data, length, hash);
+            });
+        }
+
+        /** @brief Create table serving lookups from arrays of a mapped file.
+         */
+        explicit flat_table_t(const mapped_table_t &mapped)
+                : ctrl(const_cast<int8_t *>(mapped.ctrl)),
+                  slots(const_cast<flat_slot_t *>(mapped.slots)),
+                  records(mapped.records), capacity(mapped.capacity),
+                  count(mapped.count), tombstones(mapped.tombstones),
+                  live_bytes(mapped.live_bytes), mapping(mapped.mapping),
+                  mapped_bytes(mapped.records_bytes) {
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        /** @brief Check if arrays read from a file form a consistent table.
+         * Control bytes must be empty, deleted or hold 7 bits of hash of their
+         * slot and their numbers must match the counters, with at least one
+         * empty slot so that every lookup ends. Record of every full slot must
+         * lie within the records, and their sizes must sum up to
+         * @p live_bytes. Arrays are read element by element.
+         * @param mapped - arrays whose sizes fit in the file.
+         * @return @p true if arrays are consistent, @p false otherwise.
+         */
+        static bool consistent(const mapped_table_t &mapped) {
+            size_t full = 0, tombstones = 0, empties = 0, live = 0;
+            for (size_t i = 0; i < mapped.capacity; i++) {
+                if (mapped.ctrl[i] == empty) {
+                    empties++;
+                    continue;
+                }
+                if (mapped.ctrl[i] == deleted) {
+                    tombstones++;
+                    continue;
+                }
+
+                const flat_slot_t &slot = mapped.slots[i];
+                if (mapped.ctrl[i] != h2(slot.hash) ||
+                    mapped.records_bytes < sizeof(uint32_t) ||
+                    slot.record > mapped.records_bytes - sizeof(uint32_t)) {
+                    return false;
+                }
+                uint32_t length = record_length(mapped.records + slot.record);
+                if (length > mapped.records_bytes - sizeof(uint32_t) - slot.record) {
+                    return false;
+                }
+                full++;
+                live += sizeof(uint32_t) + length;
+            }
+            return full == mapped.count && tombstones == mapped.tombstones &&
+                   empties > 0 && live == mapped.live_bytes;
+        }
+
+        /** @brief Check if table serves its arrays from a mapped file.
+         */
+        bool is_mapped() const {
+            return mapping != nullptr;
+        }
+
+        /** @brief Arrays of the table in the form stored in a file.
+         * Mapping is not set.
+         */
+        mapped_table_t arrays() const {
+            return {ctrl, slots, records, capacity, count, tombstones, live_bytes,
+                    is_mapped() ? mapped_bytes : arena.used_bytes(), nullptr};
+        }
+
+        /** @brief Compute memory usage and shape of the table.
+         * Probe sequence of every stored value is followed, so it takes time
+         * linear in the number of values and their probe lengths.
+         */
+        table_stats_t stats() const {
+            size_t payload = live_bytes - count * sizeof(uint32_t);
+            size_t records_bytes = is_mapped() ? mapped_bytes : arena.reserved_bytes();
+            table_stats_t stats{payload, sizeof(flat_table_t) + records_bytes - payload +
+                                capacity * (sizeof(int8_t) + sizeof(flat_slot_t)),
+                                capacity, 0};
+
+            for (size_t i = 0; i < capacity; i++) {
+                if (ctrl[i] >= 0) {
+                    size_t group = first_group(slots[i].hash);
+                    size_t probes = 1;
+                    for (size_t step = 1; group != i / group_width; step++) {
+                        group = (group + step) & (capacity / group_width - 1);
+                        probes++;
+                    }
+                    stats.longest_probe = std::max(stats.longest_probe, probes);
+                }
+            }
+            return stats;
+        }
+
+        /** @brief Check if table contains given value.
+         */
+        bool contains(const enc_value_t &enc_value) const {
+            return contains(enc_value.value.data(), enc_value.value.size(),
+                            enc_value.hash);
+        }
+
+        /** @brief Check if table contains value with given bytes and hash.
+         */
+        bool contains(const char *data, const size_t length, const size_t hash) const {
+            return locate(data, length, hash) != npos;
+        }
+
+        /** @brief Prefetch first group of slots probed for given hash.
+         */
+        void prefetch(const size_t hash) const {
+            if (capacity != 0) {
+                __builtin_prefetch(ctrl + first_group(hash) * group_width);
+                __builtin_prefetch(slots + first_group(hash) * group_width);
+            }
+        }
+
+        /** @brief Insert value known not to be present.
+         * Table is rebuilt when it gets too full, and also when records of
+         * erased values take more of the arena than live ones, as erasing
+         * often leaves no tombstone and would otherwise never trigger it.
+         * @param data - bytes of value.
+         * @param length - length of value.
+         * @param hash - hash of value.
+         */
+        void insert_absent(const char *data, const size_t length, const size_t hash) {
+            size_t dead_bytes = arena.used_bytes() - live_bytes;
+            if ((count + tombstones + 1) * 8 > capacity * 7 ||
+                dead_bytes > std::max(live_bytes, min_dead_bytes)) {
+                rehash(capacity_for(2 * (count + 1)));
+            }
+
+            size_t i = free_slot(hash);
+            if (ctrl[i] == deleted) {
+                tombstones--;
+            }
+            ctrl[i] = h2(hash);
+            slots[i] = {hash, add_record(data, static_cast<uint32_t>(length))};
+            count++;
+            live_bytes += sizeof(uint32_t) + length;
+        }
+
+        /** @brief Insert given value if it is not present.
+         * @param data - bytes of value.
+         * @param length - length of value.
+         * @param hash - hash of value.
+         * @return @p true if value was inserted, @p false if it was present.
+         */
+        bool insert(const char *data, const size_t length, const size_t hash) {
+            if (locate(data, length, hash) != npos) {
+                return false;
+            }
+            insert_absent(data, length, hash);
+            return true;
+        }
+
+        /** @brief Erase given value if it is present.
+         * Slot becomes empty if its group already has an empty slot, because
+         * then no lookup continues past this group. Otherwise it becomes
+         * a tombstone.
+         * @param data - bytes of value.
+         * @param length - length of value.
+         * @param hash - hash of value.
+         * @return @p true if value was erased, @p false if it was not present.
+         */
+        bool erase(const char *data, const size_t length, const size_t hash) {
+            size_t i = locate(data, length, hash);
+            if (i == npos) {
+                return false;
+            }
+
+            if (match(i / group_width, empty) != 0) {
+                ctrl[i] = empty;
+            }
+            else {
+                ctrl[i] = deleted;
+                tombstones++;
+            }
+            count--;
+            live_bytes -= sizeof(uint32_t) + length;
+            return true;
+        }
+
+        /** @brief Erase given value if it is present.
+         * @return @p true if value was erased, @p false if it was not present.
+         */
+        bool erase(const enc_value_t &enc_value) {
+            return erase(enc_value.value.data(), enc_value.value.size(), enc_value.hash);
+        }
+
+        /** @brief Make room for given number of values without rehashing.
+         */
+        void reserve(const size_t values) {
+            if ((values + tombstones) * 8 > capacity * 7) {
+                rehash(capacity_for(values));
+            }
+        }
+
+        /** @brief Remove all values and free memory of the table.
+         */
+        void clear() {
+            *this = flat_table_t();
+        }
+
+        /** @brief Call given function with every value and its hash.
+         * @param func - function taking pointer to value bytes, value length
+         *               and value hash.
+         */
+        template <typename func_t>
+        void for_each(func_t func) const {
+            for (size_t i = 0; i < capacity; i++) {
+                if (ctrl[i] >= 0) {
+                    const char *record = records + slots[i].record;
+                    func(record_data(record), record_length(record), slots[i].hash);
+                }
+            }
+        }
+    };
+
+    /**
+     * Blocked Bloom filter of value hashes. Each value sets one bit in each of
+     * the @p block_words words of a single 32-byte block, so a lookup reads one
+     * cache line. Block and bits are derived from the hash mixed again, as its
+     * low bits already select stripe and table group.
+     */
+    class bloom_filter_t {
+        static constexpr size_t block_words = 8;
+        static constexpr uint32_t salts[block_words] = {
+            0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+            0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+
+        std::unique_ptr<uint32_t[]> words;
+        size_t blocks;
+        size_t values;
+
+        static uint64_t mix(const size_t hash) {
+            return uint64_t(hash) * 0x9e3779b97f4a7c15ull;
+        }
+
+        /** @brief Index of the first word of block selected by mixed hash.
+         */
+        size_t block(const uint64_t mixed) const {
+            return ((mixed >> 32) * blocks >> 32) * block_words;
+        }
+
+    public:
+        /** @brief Create empty filter sized for given number of values.
+         * @param values - number of values the filter is sized for.
+         * @param bits_per_value - number of filter bits per value.
+         */
+        bloom_filter_t(const size_t values, const unsigned bits_per_value)
+                : blocks(std::max<size_t>(1, values * bits_per_value / (32 * block_words))),
+                  values(values) {
+            words.reset(new uint32_t[blocks * block_words]());
+        }
+
+        /** @brief Number of values the filter is sized for.
+         */
+        size_t capacity() const {
+            return values;
+        }
+
+        /** @brief Number of bytes taken by the filter.
+         */
+        size_t bytes() const {
+            return sizeof(bloom_filter_t) + blocks * block_words * sizeof(uint32_t);
+        }
+
+        void add(const size_t hash) {
+            uint64_t mixed = mix(hash);
+            uint32_t *bits = words.get() + block(mixed);
+            for (size_t i = 0; i < block_words; i++) {
+                bits[i] |= 1u << ((uint32_t(mixed) * salts[i]) >> 27);
+            }
+        }
+
+        /** @brief Check if value with given hash may have been added.
+         * @return @p false if value with given hash was surely not added.
+         */
+        bool may_contain(const size_t hash) const {
+            uint64_t mixed = mix(hash);
+            const uint32_t *bits = words.get() + block(mixed);
+            uint32_t missing = 0;
+            for (size_t i = 0; i < block_words; i++) {
+                missing |= ~bits[i] & (1u << ((uint32_t(mixed) * salts[i]) >> 27));
+            }
+            return missing == 0;
+        }
+    };
+
+    /**
+     * Part of a set holding values whose hashes select it through
+     * @p stripe_index. Readers take its lock shared, writers exclusively.
+     * Table is @p nullptr while stripe is empty and may be shared with stripes
+     * of set copies or mapped from a file, in which case it is immutable:
+     * stripe wanting to modify it makes its own copy first. Holders of
+     * a reference to table can therefore read it after releasing the lock.
+     * If set has a filter, stripe keeps one for its table. Bits of removed
+     * values stay in the filter until it is rebuilt, which happens on
+     * modification of the stripe once they outnumber present values or
+     * present values outgrow the filter, and whenever the table is replaced.
+     */
+    struct alignas(64) enc_stripe_t {
+        std::shared_mutex mutex;
+        std::shared_ptr<const flat_table_t> table;
+        std::atomic<size_t> size{0};
+        unsigned filter_bits = 0;
+        std::unique_ptr<bloom_filter_t> filter;
+        size_t filter_removed = 0;
+        std::atomic<uint64_t> filter_rejected{0};
+        std::atomic<uint64_t> filter_passed{0};
+        std::atomic<uint64_t> filter_false_positives{0};
+        std::atomic<uint64_t> inserts{0};
+        std::atomic<uint64_t> removes{0};
+        std::atomic<uint64_t> tests{0};
+        std::atomic<uint64_t> hits{0};
+
+        /** @brief Get table which this stripe may modify.
+         * Create empty table or copy of shared or mapped one if needed.
+         * Stripe must be locked exclusively.
+         * @return Reference to table owned by this stripe alone.
+         */
+        flat_table_t &writable() {
+            if (table == nullptr) {
+                table = std::make_shared<flat_table_t>();
+            }
+            else if (is_immutable()) {
+                table = std::make_shared<flat_table_t>(*table);
+            }
+            else {
+                // Pairs with release of the reference by last other holder.
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+            return const_cast<flat_table_t &>(*table);
+        }
+
+        /** @brief Check if stripe table has to be copied before modification.
+         * Stripe must be locked and its table must not be @p nullptr.
+         */
+        bool is_immutable() const {
+            return table.use_count() > 1 || table->is_mapped();
+        }
+
+        /** @brief Check if stripe contains given value.
+         * Stripe must be locked.
+         */
+        bool contains(const enc_value_t &enc_value) const {
+            return table != nullptr && table->contains(enc_value);
+        }
+
+        /** @brief Build filter of all values of the table anew.
+         * Filter is sized for twice the present values, so that it is rebuilt
+         * after the number of values doubles. Stripe must be locked exclusively.
+         */
+        void rebuild_filter() {
+            size_t values = table == nullptr ? 0 : table->size();
+            filter = std::make_unique<bloom_filter_t>(std::max<size_t>(2 * values, 64),
+                                                      filter_bits);
+            filter_removed = 0;
+            if (table != nullptr) {
+                table->for_each([this](const char *, uint32_t, size_t hash) {
+                    filter->add(hash);
+                });
+            }
+        }
+
+        /** @brief Update filter after value was inserted to the table.
+         * Stripe must be locked exclusively.
+         * @param hash - hash of inserted value.
+         */
+        void filter_inserted(const size_t hash) {
+            if (filter_bits == 0) {
+                return;
+            }
+            if (filter != nullptr && table->size() <= filter->capacity()) {
+                filter->add(hash);
+            }
+            else {
+                rebuild_filter();
+            }
+        }
+
+        /** @brief Update filter after value was removed from the table.
+         * Stripe must be locked exclusively.
+         */
+        void filter_erased() {
+            if (filter_bits != 0 && (filter == nullptr || ++filter_removed > table->size())) {
+                rebuild_filter();
+            }
+        }
+
+        /** @brief Rebuild filter after the table was replaced.
+         * Filter is built from hashes stored in the new table, so values are
+         * not hashed again. Stripe must be locked exclusively.
+         */
+        void filter_replaced() {
+            if (filter_bits == 0) {
+                filter.reset();
+            }
+            else {
+                rebuild_filter();
+            }
+        }
+
+        /** @brief Check if filter shows that value is not present.
+         * Stripe must be locked.
+         * @param hash - hash of the value.
+         * @return @p true if value is surely not present in the stripe.
+         */
+        bool filter_rejects(const size_t hash) {
+            if (filter == nullptr) {
+                return false;
+            }
+            if (!filter->may_contain(hash)) {
+                filter_rejected.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            filter_passed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    };
+
+    /** @brief Index of stripe holding value with given hash.
+     * Uses bits of hash above these used for control bytes of stripe table.
+     * @param hash - hash of encrypted value.
+     * @return Index of stripe.
+     */
+    inline size_t stripe_index(const size_t hash) {
+        return (hash >> 7) % stripe_count;
+    }
+
+    /**
+     * Set of encrypted values split into @p stripe_count stripes.
+     */
+    struct enc_set_t {
+        std::array<enc_stripe_t, stripe_count> stripes;
+
+        enc_stripe_t &stripe(const size_t hash) {
+            return stripes[stripe_index(hash)];
+        }
+
+        size_t size() const {
+            size_t size = 0;
+            for (const enc_stripe_t &stripe : stripes) {
+                size += stripe.size.load(std::memory_order_relaxed);
+            }
+            return size;
+        }
+    };
+
+    /**
+     * Slot of the set registry. Holds the set with identifier equal to the slot
+     * position or @p nullptr if that set has been deleted or not yet created.
+     */
+    using enc_set_slot_t = std::atomic<enc_set_t *>;
+    /**
+     * Chunk of @p enc_set_slot_t slots, allocated when first set in it is created.
+     */
+    struct enc_set_chunk_t {
+        enc_set_slot_t slots[1ul << chunk_bits];
+    };
+
+    /**
+     * Per-thread record of epoch in which thread entered its current operation
+     * or 0 if it is not inside one. Records are kept in a list and reused by
+     * later threads.
+     */
+    struct alignas(64) epoch_record_t {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> in_use{true};
+        epoch_record_t *next = nullptr;
+    };
+
+    /**
+     * Registry of sets. Sets are found without locking through two-level table
+     * of chunks. Deleted sets are retired and freed only when no thread can
+     * still use them, which is tracked by epochs.
+     */
+    struct enc_registry_t {
+        std::atomic<unsigned long> added_sets{0};
+        std::atomic<enc_set_chunk_t *> chunks[chunk_count];
+        std::atomic<uint64_t> epoch{1};
+        std::atomic<epoch_record_t *> epoch_records{nullptr};
+        std::mutex retired_mutex;
+        std::vector<std::pair<uint64_t, enc_set_t *>> retired;
+    };
+
+    /**
+     * Slot of the trace ring. Writer of record at position @p p sets
+     * @p sequence to 2p + 1, stores the fields and then sets it to 2p + 2,
+     * so readers can tell complete records from overwritten or partly
+     * written ones.
+     */
+    struct trace_slot_t {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<unsigned long> id{0};
+        std::atomic<uint64_t> hash{0};
+        std::atomic<size_t> length{0};
+        std::atomic<unsigned char> op{0};
+        std::atomic<bool> result{false};
+    };
+
+    /**
+     * Lock-free ring of the most recently performed operations. Writers
+     * reserve positions by incrementing @p head, which is kept in a separate
+     * cache line from @p enabled checked by every operation.
+     */
+    struct trace_ring_t {
+        alignas(64) std::atomic<bool> enabled{false};
+        alignas(64) std::atomic<uint64_t> head{0};
+        trace_slot_t slots[trace_capacity];
+    };
+
+    /**
+     * Function XOR-ing @p length bytes of @p data with cyclically repeated key.
+     * Byte @p data[i] is XOR-ed with @p key_stream[i % period], where
+     * @p key_stream holds @p period + @p xor_block bytes of the key repeated.
+     */
+    using xor_func_t = void (*)(char *data, size_t length,
+                                const char *key_stream, size_t period);
+    /**
+     * Key repeated cyclically to the length of the shortest multiple of key
+     * length not shorter than @p xor_block (the period), plus @p xor_block
+     * bytes, so that a whole block of the stream can be read from any position
+     * within the period.
+     */
+    struct key_stream_t {
+        string key;
+        string stream;
+        size_t period = 0;
+    };
+
+    /**
+     * Funtion used to perform operation on slot of set. Returns @p false
+     * if slot held no set.
+     */
+    using set_func_t = bool (*)(enc_set_slot_t &);
+    /**
+     * Function used to perform operation on passed encrypted value and given set.
+     * Returns @p true if the value was present in the set before the operation.
+     */
+    using val_func_t = bool (*)(enc_set_t &, enc_value_t &);
+    /**
+     * Function used to perform operation on passed encrypted value and given
+     * stripe, which caller has already locked. Returns @p true if the value was
+     * present in the stripe before the operation.
+     */
+    using stripe_func_t = bool (*)(enc_stripe_t &, enc_value_t &);
+    /**
+     * Description of value operation performed on a batch of values: function
+     * performing it on locked stripe, whether it needs stripe locked exclusively
+     * and whether it adds values to stripe.
      */
-    using msg_pair_t = std::pair<string, string>;
+    struct batch_op_t {
+        stripe_func_t func;
+        bool exclusive;
+        bool adds;
+    };
     /**
-     * Pair storing @p val_func_t pointers to functions performing operations
-     * on given value and specified set.
+     * Pair storing @p string_view objects, representing diagnostic messages
+     * printed if debug mode is on.
      */
-    using val_func_pair_t = std::pair<val_func_t, val_func_t>;
+    using msg_pair_t = std::pair<string_view, string_view>;
     /**
      * Pair storing @p bool objects to be returned when handling value operation
      * with given set.
@@ -63,47 +970,241 @@ namespace {
         return std::cerr;
     }
 
-    /** @brief Wrapper function of the counter of sets added.
-     * Initialise counter of added sets and return reference to it.
-     * Counter is only initialised at first invocation of the function.
-     * @return Reference to counter of added sets.
+    /** @brief Wrapper function of registry storing sets by their identifiers.
+     * Initialise registry and return reference to it. Registry is only
+     * initialised at first invocation of the function.
+     * @return Reference to registry storing sets by their identifiers.
      */
-    unsigned long &added_sets() {
-        static unsigned long added_sets = 0;
-        return added_sets;
+    enc_registry_t &registry() {
+        static enc_registry_t registry;
+        return registry;
     }
 
-    /** @brief Wrapper function of map storing sets by their identifiers.
-     * Initialise map storing sets by their identifiers and return reference to it.
-     * Map is only initialised at first invocation of the function.
-     * @return Reference to map storing sets by their identifiers.
+    /**
+     * Settings of operations performed by multiple threads, changed by
+     * @p encstrset_set_parallelism: largest number of threads, 0 meaning one
+     * per hardware thread, and number of values from which they are used.
      */
-    id_to_enc_set_t &id_to_enc_set() {
-        static id_to_enc_set_t id_to_enc_set;
-        return id_to_enc_set;
-    }
+    struct parallelism_t {
+        std::atomic<unsigned> max_threads{0};
+        std::atomic<size_t> min_values{parallel_values};
+    };
 
-    /** @brief Wrapper function of string literal used to represent set
-     * in diagnostic messages.
-     * @return String literal used to represent set.
+    /** @brief Wrapper function of settings of multi-threaded operations.
+     * @return Reference to the settings.
      */
-    inline string set_id_msg() {
-        return "set #";
+    parallelism_t &parallelism() {
+        static parallelism_t settings;
+        return settings;
     }
 
-    /** @brief Wrapper function of string literal informing that set is not
-     * present, used in diagnostic messages.
-     * @return String literal used to inform that set is not present.
+    /** @brief Wrapper function of the trace ring.
+     * Ring is constant-initialised, so no initialisation is performed
+     * at invocation of the function.
+     * @return Reference to the trace ring.
      */
-    inline string set_not_present_msg() {
-        return " does not exist";
+    trace_ring_t &trace_ring() {
+        static trace_ring_t ring;
+        return ring;
+    }
+
+    /** @brief Record operation in the trace if tracing is on.
+     * @param op - kind of the operation.
+     * @param id - identifier of a set operated on.
+     * @param hash - hash of encrypted value or other operation argument.
+     * @param length - length of encrypted value or other operation result.
+     * @param result - result of the operation.
+     */
+    inline void trace(jnp1::encstrset_trace_op op, unsigned long id,
+                      uint64_t hash, size_t length, bool result) {
+        trace_ring_t &ring = trace_ring();
+        if (!tracing || !ring.enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        uint64_t position = ring.head.fetch_add(1, std::memory_order_relaxed);
+        trace_slot_t &slot = ring.slots[position & (trace_capacity - 1)];
+        slot.sequence.store(2 * position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.id.store(id, std::memory_order_relaxed);
+        slot.hash.store(hash, std::memory_order_relaxed);
+        slot.length.store(length, std::memory_order_relaxed);
+        slot.op.store(op, std::memory_order_relaxed);
+        slot.result.store(result, std::memory_order_relaxed);
+        slot.sequence.store(2 * position + 2, std::memory_order_release);
+    }
+
+    /** @brief Get epoch record of the calling thread.
+     * Take unused record from the registry list or add new one at first
+     * invocation of the function in given thread. Record is released when
+     * thread exits.
+     * @return Reference to epoch record of the calling thread.
+     */
+    epoch_record_t &thread_epoch_record() {
+        struct holder_t {
+            epoch_record_t *record = nullptr;
+
+            holder_t() {
+                std::atomic<epoch_record_t *> &records = registry().epoch_records;
+                for (epoch_record_t *r = records.load(); r != nullptr; r = r->next) {
+                    bool in_use = false;
+                    if (r->in_use.compare_exchange_strong(in_use, true)) {
+                        record = r;
+                        return;
+                    }
+                }
+
+                record = new epoch_record_t;
+                record->next = records.load();
+                while (!records.compare_exchange_weak(record->next, record)) {
+                }
+            }
+
+            ~holder_t() {
+                record->in_use.store(false, std::memory_order_release);
+            }
+        };
+
+        thread_local holder_t holder;
+        return *holder.record;
+    }
+
+    /**
+     * Guard marking the calling thread as inside an operation for its lifetime.
+     * Sets found in registry may only be used while guard exists.
+     */
+    class epoch_guard_t {
+        epoch_record_t &record;
+
+    public:
+        epoch_guard_t() : record(thread_epoch_record()) {
+            record.epoch.store(registry().epoch.load());
+        }
+
+        ~epoch_guard_t() {
+            record.epoch.store(0, std::memory_order_release);
+        }
+
+        epoch_guard_t(const epoch_guard_t &) = delete;
+        epoch_guard_t &operator=(const epoch_guard_t &) = delete;
+    };
+
+    /** @brief Find slot of set with given id.
+     * Must be called under @p epoch_guard_t.
+     * @param id - identifier of a set whose slot is to be found.
+     * @return Pointer to slot of set with given id or @p nullptr if no set
+     * with identifier in its chunk has been created.
+     */
+    inline enc_set_slot_t *find_slot(const unsigned long id) {
+        if ((id >> chunk_bits) >= chunk_count) {
+            return nullptr;
+        }
+
+        enc_set_chunk_t *chunk =
+            registry().chunks[id >> chunk_bits].load(std::memory_order_acquire);
+        return chunk == nullptr ? nullptr : &chunk->slots[id & ((1ul << chunk_bits) - 1)];
+    }
+
+    /** @brief Find set with given id.
+     * Must be called under @p epoch_guard_t.
+     * @param id - identifier of a set to find.
+     * @return Pointer to set with given id or @p nullptr if it does not exist.
+     */
+    inline enc_set_t *find_set(const unsigned long id) {
+        enc_set_slot_t *slot = find_slot(id);
+        return slot == nullptr ? nullptr : slot->load(std::memory_order_acquire);
+    }
+
+    /** @brief Retire set removed from the registry.
+     * Set is freed later by @p reclaim_sets.
+     * @param set - set to be retired.
+     */
+    void retire_set(enc_set_t *set) {
+        enc_registry_t &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.retired_mutex);
+        reg.retired.emplace_back(reg.epoch.fetch_add(1), set);
+    }
+
+    /** @brief Store set in the registry.
+     * Allocate chunk for given id if it is not allocated yet. Set previously
+     * stored with the same id is retired. Identifiers beyond registry capacity
+     * get no set and behave as deleted.
+     * @param id - identifier of the set.
+     * @param set - set to be stored.
+     */
+    void add_set(const unsigned long id, enc_set_t *set) {
+        if ((id >> chunk_bits) >= chunk_count) {
+            delete set;
+            return;
+        }
+
+        std::atomic<enc_set_chunk_t *> &chunk = registry().chunks[id >> chunk_bits];
+        enc_set_chunk_t *current = chunk.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            enc_set_chunk_t *allocated = new enc_set_chunk_t();
+            if (chunk.compare_exchange_strong(current, allocated)) {
+                current = allocated;
+            }
+            else {
+                delete allocated;
+            }
+        }
+
+        enc_set_t *previous = current->slots[id & ((1ul << chunk_bits) - 1)].exchange(set);
+        if (previous != nullptr) {
+            retire_set(previous);
+        }
+    }
+
+    /** @brief Free retired sets no thread can be using anymore.
+     * Set retired in epoch @p e is in use only by threads that entered their
+     * operation in epoch not later than @p e.
+     */
+    void reclaim_sets() {
+        enc_registry_t &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.retired_mutex);
+
+        uint64_t oldest = UINT64_MAX;
+        for (epoch_record_t *r = reg.epoch_records.load(); r != nullptr; r = r->next) {
+            uint64_t epoch = r->epoch.load();
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+
+        size_t kept = 0;
+        for (const std::pair<uint64_t, enc_set_t *> &retired : reg.retired) {
+            if (retired.first < oldest) {
+                delete retired.second;
+            }
+            else {
+                reg.retired[kept++] = retired;
+            }
+        }
+        reg.retired.resize(kept);
+    }
+
+    /** @brief Wrapper function of string literal used to represent set
+     * in diagnostic messages.
+     * @return String literal used to represent set.
+     */
+    inline const char *set_id_msg() {
+        return "set #";
+    }
+
+    /** @brief Wrapper function of string literal informing that set is not
+     * present, used in diagnostic messages.
+     * @return String literal used to inform that set is not present.
+     */
+    inline const char *set_not_present_msg() {
+        return " does not exist";
     }
 
     /** @brief Print function call if debug mode is on.
      * @param func_name - name of the called function to print.
      * @param id - set identifier passed to function @p func_name.
      */
-    inline void print_func_call_if_debug(const string &func_name,
+    inline void print_func_call_if_debug(string_view func_name,
                                          unsigned long id) {
         if (debug) {
             cerr() << func_name << "(" << id << ")" << endl;
@@ -117,287 +1218,1275 @@ namespace {
      * @param dst_id - set id passed to fucntion @p func_name where encrypted
      *                 values are copied to.
      */
-    inline void print_func_call_if_debug(const string &func_name,
+    inline void print_func_call_if_debug(string_view func_name,
                                          unsigned long src_id,
                                          unsigned long dst_id) {
         if (debug) {
             cerr() << func_name << "(" << src_id << ", " << dst_id << ")" << endl;
         }
-    }
+    }
+
+    /** @brief Print message when performing set operation.
+     * @param func_name - name of the function where set operation is performed.
+     * @param id - set identifier.
+     * @param msg - message to print.
+     */
+    inline void print_set_msg_if_debug(string_view func_name,
+                                       unsigned long id, string_view msg) {
+        if (debug) {
+            cerr() << func_name << ": " << set_id_msg() << id << msg << endl;
+        }
+    }
+
+    /** @brief Print message when invoking function.
+     * @param func_name - name of the invoked function.
+     * @param msg - message to print.
+     */
+    inline void print_func_msg_if_debug(string_view func_name,
+                                        string_view msg) {
+        if (debug) {
+            cerr() << func_name << msg << endl;
+        }
+    }
+
+    /** @brief Remove all values from set held by given slot.
+     * Lock all stripes of the set exclusively and clear them.
+     * @param slot - slot of a set to be cleared.
+     * @return @p true if slot held a set, @p false otherwise.
+     */
+    bool clear_set(enc_set_slot_t &slot) {
+        enc_set_t *set = slot.load(std::memory_order_acquire);
+        if (set == nullptr) {
+            return false;
+        }
+
+        for (enc_stripe_t &stripe : set->stripes) {
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            stripe.table.reset();
+            stripe.size.store(0, std::memory_order_relaxed);
+            stripe.filter_replaced();
+        }
+        return true;
+    }
+
+    /** @brief Remove set held by given slot from the registry.
+     * Set is retired and freed later by @p reclaim_sets.
+     * @param slot - slot of a set to be erased.
+     * @return @p true if slot held a set, @p false otherwise.
+     */
+    bool erase_set(enc_set_slot_t &slot) {
+        enc_set_t *set = slot.exchange(nullptr);
+        if (set == nullptr) {
+            return false;
+        }
+
+        retire_set(set);
+        return true;
+    }
+
+    /** @brief Insert given value to given locked stripe.
+     * Value bytes are copied into the stripe arena if it was not present.
+     * @param stripe - exclusively locked stripe where value is to be inserted.
+     * @param enc_value - value to be inserted.
+     * @return @p true if value was already present in the stripe, @p false
+     * otherwise.
+     */
+    bool insert_to_stripe(enc_stripe_t &stripe, enc_value_t &enc_value) {
+        stripe.inserts.fetch_add(1, std::memory_order_relaxed);
+        if (stripe.contains(enc_value)) {
+            return true;
+        }
+        stripe.writable().insert_absent(enc_value.value.data(), enc_value.value.size(),
+                                        enc_value.hash);
+        stripe.size.fetch_add(1, std::memory_order_relaxed);
+        stripe.filter_inserted(enc_value.hash);
+        return false;
+    }
+
+    /** @brief Remove given value from given locked stripe.
+     * @param stripe - exclusively locked stripe from where value is to be removed.
+     * @param enc_value - value to be removed.
+     * @return @p true if value was present in the stripe, @p false otherwise.
+     */
+    bool erase_from_stripe(enc_stripe_t &stripe, enc_value_t &enc_value) {
+        stripe.removes.fetch_add(1, std::memory_order_relaxed);
+        // Immutable table is copied only if the value is there to be erased.
+        if (stripe.table == nullptr ||
+            (stripe.is_immutable() && !stripe.table->contains(enc_value)) ||
+            !stripe.writable().erase(enc_value)) {
+            return false;
+        }
+        stripe.size.fetch_sub(1, std::memory_order_relaxed);
+        stripe.filter_erased();
+        return true;
+    }
+
+    /** @brief Check if given value is present in given locked stripe.
+     * @param stripe - locked stripe where value is to be searched.
+     * @param enc_value - value to be searched.
+     * @return @p true if stripe contains passed value, @p false otherwise.
+     */
+    bool find_in_stripe(enc_stripe_t &stripe, enc_value_t &enc_value) {
+        stripe.tests.fetch_add(1, std::memory_order_relaxed);
+        if (stripe.filter_rejects(enc_value.hash)) {
+            return false;
+        }
+
+        bool present = stripe.contains(enc_value);
+        if (present) {
+            stripe.hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (stripe.filter != nullptr) {
+            stripe.filter_false_positives.fetch_add(1, std::memory_order_relaxed);
+        }
+        return present;
+    }
+
+    /** @brief Insert given value to given set.
+     * Insert under exclusive lock of value stripe.
+     * @param set - set where passed value is to be inserted.
+     * @param enc_value - value to be inserted.
+     * @return @p true if value was already present in the set, @p false otherwise.
+     */
+    bool insert_value(enc_set_t &set, enc_value_t &enc_value) {
+        enc_stripe_t &stripe = set.stripe(enc_value.hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return insert_to_stripe(stripe, enc_value);
+    }
+
+    /** @brief Remove given value from given set.
+     * Remove under exclusive lock of value stripe.
+     * @param set - set from where passed value is to be removed.
+     * @param enc_value - value to be removed.
+     * @return @p true if value was present in the set, @p false otherwise.
+     */
+    bool erase_value(enc_set_t &set, enc_value_t &enc_value) {
+        enc_stripe_t &stripe = set.stripe(enc_value.hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return erase_from_stripe(stripe, enc_value);
+    }
+
+    /** @brief Check if given encrypted value is present in given set.
+     * Search under shared lock of value stripe.
+     * @param set - set where given encrypted value is to be searched.
+     * @param enc_value - encrypted value to be searched.
+     * @return @p true if set contains passed encrypted value, @p false otherwise.
+     */
+    bool find_value(enc_set_t &set, enc_value_t &enc_value) {
+        enc_stripe_t &stripe = set.stripe(enc_value.hash);
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        return find_in_stripe(stripe, enc_value);
+    }
+
+    /** @brief Create C++ string representation understandable by the compiler
+     * of passed C-style string.
+     * @param str - C-style string whose representation is to be created.
+     * @return string object of the form "str" if @p str is not @p nullptr,
+     * "NULL" otherwise.
+     */
+    inline string string_repr(const char *str) {
+        string enclosing = (str == nullptr ? "" : R"(")");
+        return enclosing + (str == nullptr ? "NULL" : str) + enclosing;
+    }
+
+    /** @brief Create cyphered version of passed string.
+     * Create new string @p cyphered_string where each character of the original
+     * string is replaced with its hexadecimal representation of length two
+     * and there are spaces inserted between any two consecutive characters
+     * from the original string.
+     * @param str - string to cypher.
+     * @return Cyphered version of passed string in the form
+     * @p cypher "cyphered_string".
+     */
+    string cypher(const string &str) {
+        stringstream cyphered;
+        cyphered << "cypher " << '"';
+
+        size_t processed = 0;
+        for (int c : str) {
+            processed++;
+
+            cyphered << std::uppercase << std::hex << c / 16 << c % 16;
+            if (processed < str.length()) {
+                cyphered << " ";
+            }
+        }
+
+        cyphered << '"';
+        return cyphered.str();
+    }
+
+    /** @brief XOR bytes of data with key stream without wrapping around.
+     * @param data - bytes to XOR.
+     * @param length - number of bytes to XOR, not greater than @p xor_block.
+     * @param key_stream - key stream starting at the position for @p data[0].
+     */
+    inline void xor_tail(char *data, size_t length, const char *key_stream) {
+        for (size_t i = 0; i < length; i++) {
+            data[i] ^= key_stream[i];
+        }
+    }
+
+    /** @brief Portable encryption kernel, XOR-ing 8 bytes at once.
+     * See @p xor_func_t.
+     */
+    void xor_scalar(char *data, size_t length, const char *key_stream,
+                    size_t period) {
+        size_t i = 0, k = 0;
+        for (; i + 8 <= length; i += 8) {
+            uint64_t block, key;
+            memcpy(&block, data + i, 8);
+            memcpy(&key, key_stream + k, 8);
+            block ^= key;
+            memcpy(data + i, &block, 8);
+
+            k += 8;
+            if (k >= period) {
+                k -= period;
+            }
+        }
+        xor_tail(data + i, length - i, key_stream + k);
+    }
+
+#ifdef ENCSTRSET_X86
+    /** @brief SSE2 encryption kernel, XOR-ing 16 bytes at once.
+     * See @p xor_func_t.
+     */
+    __attribute__((target("sse2")))
+    void xor_sse2(char *data, size_t length, const char *key_stream,
+                  size_t period) {
+        size_t i = 0, k = 0;
+        for (; i + 16 <= length; i += 16) {
+            __m128i *block = reinterpret_cast<__m128i *>(data + i);
+            __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key_stream + k));
+            _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), key));
+
+            k += 16;
+            if (k >= period) {
+                k -= period;
+            }
+        }
+        xor_tail(data + i, length - i, key_stream + k);
+    }
+
+    /** @brief AVX2 encryption kernel, XOR-ing 32 bytes at once.
+     * See @p xor_func_t.
+     */
+    __attribute__((target("avx2")))
+    void xor_avx2(char *data, size_t length, const char *key_stream,
+                  size_t period) {
+        size_t i = 0, k = 0;
+        for (; i + 32 <= length; i += 32) {
+            __m256i *block = reinterpret_cast<__m256i *>(data + i);
+            __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(key_stream + k));
+            _mm256_storeu_si256(block, _mm256_xor_si256(_mm256_loadu_si256(block), key));
+
+            k += 32;
+            if (k >= period) {
+                k -= period;
+            }
+        }
+        xor_tail(data + i, length - i, key_stream + k);
+    }
+
+    /** @brief AVX-512 encryption kernel, XOR-ing 64 bytes at once.
+     * See @p xor_func_t.
+     */
+    __attribute__((target("avx512f")))
+    void xor_avx512(char *data, size_t length, const char *key_stream,
+                    size_t period) {
+        size_t i = 0, k = 0;
+        for (; i + 64 <= length; i += 64) {
+            __m512i block = _mm512_loadu_si512(data + i);
+            __m512i key = _mm512_loadu_si512(key_stream + k);
+            _mm512_storeu_si512(data + i, _mm512_xor_si512(block, key));
+
+            k += 64;
+            if (k >= period) {
+                k -= period;
+            }
+        }
+        xor_tail(data + i, length - i, key_stream + k);
+    }
+#endif
+
+    /** @brief Choose the widest encryption kernel supported by the processor.
+     * @return Pointer to chosen encryption kernel.
+     */
+    xor_func_t best_xor_kernel() {
+#ifdef ENCSTRSET_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return xor_avx512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return xor_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return xor_sse2;
+        }
+#endif
+        return xor_scalar;
+    }
+
+    /** @brief Wrapper function of the encryption kernel in use.
+     * Kernel is only chosen at first invocation of the function.
+     * @return Pointer to encryption kernel.
+     */
+    xor_func_t xor_kernel() {
+        static const xor_func_t kernel = best_xor_kernel();
+        return kernel;
+    }
+
+    /** @brief Get key stream of given key.
+     * Key stream of the last key used by calling thread is cached, so that
+     * it is only built when the key changes.
+     * @param key - key whose stream is to be returned.
+     * @param key_length - length of @p key, greater than 0.
+     * @return Reference to key stream of given key.
+     */
+    const key_stream_t &thread_key_stream(const char *key, size_t key_length) {
+        thread_local key_stream_t cached;
+        if (cached.key.size() != key_length ||
+            memcmp(cached.key.data(), key, key_length) != 0) {
+            cached.key.assign(key, key_length);
+            cached.period = key_length * ((xor_block + key_length - 1) / key_length);
+            cached.stream.resize(cached.period + xor_block);
+            for (size_t i = 0; i < cached.stream.size(); i++) {
+                cached.stream[i] = key[i % key_length];
+            }
+        }
+        return cached;
+    }
+
+    /** @brief Encrypt passed value with given key into given string.
+     * Replace content of @p enc_value with passed value encrypted with given key,
+     * reusing its buffer. Encryption is symmetric and is done by XOR operation.
+     * If given key is shorter than the value, it is cyclically repeated. If given
+     * value is @p nullptr, @p enc_value becomes empty. If given key is @p nullptr
+     * or is an empty string, no encryption is performed and @p enc_value becomes
+     * copy of the passed value. Values shorter than a vector are XOR-ed byte by
+     * byte, longer ones by the widest kernel supported by the processor.
+     * @param value - C-style string representing value to be encrypted.
+     * @param key - C-style string representing key to be used in encryption.
+     * @param enc_value - string where encrypted value is to be stored.
+     */
+    void encrypt_value(const char *value, const char *key, string &enc_value) {
+        if (value == nullptr) {
+            enc_value.clear();
+            return;
+        }
+
+        enc_value.assign(value);
+        if (key == nullptr || *key == '\0') {
+            return;
+        }
+
+        size_t key_length = strlen(key);
+        if (enc_value.size() < 16) {
+            for (size_t i = 0, k = 0; i < enc_value.size(); i++) {
+                enc_value[i] ^= key[k];
+                if (++k == key_length) {
+                    k = 0;
+                }
+            }
+        }
+        else {
+            const key_stream_t &key_stream = thread_key_stream(key, key_length);
+            xor_kernel()(&enc_value[0], enc_value.size(), key_stream.stream.data(),
+                         key_stream.period);
+        }
+    }
+
+    /** @brief Wrapper function of encrypted value reused by calling thread.
+     * Holds buffer for values which are only looked up, so that looking them up
+     * does not allocate memory. Buffer is only initialised at first invocation
+     * of the function in given thread.
+     * @return Reference to encrypted value of the calling thread.
+     */
+    enc_value_t &thread_enc_value() {
+        thread_local enc_value_t enc_value;
+        return enc_value;
+    }
+
+    /** @brief Perform specified set operation and print diagnostic messages
+     * if debug mode is on.
+     * Print function call that invoked this function if debug mode is on.
+     * Check if set with given is present. If so, perform specified operation
+     * and print appropriate diagnostic message if debug mode is on. Otherwise,
+     * only print appropriate diagnostic message if debug mode is on.
+     * @param func_name - name of the function that invoked this function.
+     * @param op - kind of operation recorded in the trace.
+     * @param id - identifier of a set on which operation is to be performed.
+     * @param msg_pair - @p msg_pair_t pair carrying diagnostic string messages
+     *                   to be printed if debug mode is on: first one if set
+     *                   exists, second one if set does not exist.
+     * @param func_if_set_present - @p set_func_t pointer to function performing
+     *                              operation on slot of set with given id.
+     */
+    void handle_set_operation(string_view func_name,
+                              jnp1::encstrset_trace_op op, unsigned long id,
+                              const msg_pair_t &msg_pair,
+                              set_func_t func_if_set_present) {
+        print_func_call_if_debug(func_name, id);
+
+        epoch_guard_t guard;
+        enc_set_slot_t *slot = find_slot(id);
+        bool present = slot != nullptr && func_if_set_present(*slot);
+        trace(op, id, 0, 0, present);
+        print_set_msg_if_debug(func_name, id, present ? msg_pair.first : msg_pair.second);
+    }
+
+    /** @brief Perform specified value operations and print diagnostic messages
+     * if debug mode is on.
+     * Print function call that invoked this function if debug mode is on.
+     * Perform appropriate value operation, print appropriate diagnostic message
+     * (if debug mode is on) and return appropriate value based if passed value
+     * is present in the set with given id.
+     * @param func_name - name of the function that invoked this function.
+     * @param op - kind of operation recorded in the trace.
+     * @param id - identifier of a set on which value operation is to be
+     *             performed.
+     * @param value - value on which operation is to be performed.
+     * @param key - key used to encrypt passed value.
+     * @param msg_pair - @p msg_pair_t pair carrying diagnostic string messages
+     *                   to be printed if debug mode is on: first one if passed
+     *                   value is valid C-style string and set with given id
+     *                   exists and contains encrypted value, second one if above
+     *                   conditions are true except that set with given id does not
+     *                   contain encrypted value.
+     * @param val_func - @p val_func_t pointer to function performing value
+     *                   operation on the set with given id, called if passed value
+     *                   is valid C-style string and set with given id exists.
+     *                   Its result tells whether set contained encrypted value.
+     * @param res_pair - @p res_pair_t pair carrying return results of type @p bool:
+     *                   first one if passed value is valid C-style string and set
+     *                   with given id exists and contains encrypted value, second
+     *                   one if above conditions are true, except that set with
+     *                   given id does not contain encrypted value.
+     * @return @p false if @p value is @p nullptr or set with given id does not
+     * exist, otherwise @p res_pair.first when set with given id contains
+     * encrypted value, otherwise @p res_pair.second.
+     */
+    bool handle_value_operation(string_view func_name,
+                                jnp1::encstrset_trace_op op, unsigned long id,
+                                const char *value, const char *key,
+                                const msg_pair_t &msg_pair,
+                                const val_func_t val_func,
+                                const res_pair_t res_pair) {
+        if (debug) {
+            cerr() << func_name << "(" << id << ", "
+                   << string_repr(value) << ", " << string_repr(key) << ")" << endl;
+        }
+
+        if (value == nullptr) {
+            trace(op, id, 0, 0, false);
+            print_func_msg_if_debug(func_name, ": invalid value (NULL)");
+            return false;
+        }
+
+        epoch_guard_t guard;
+        enc_set_t *set = find_set(id);
+        if (set == nullptr) {
+            trace(op, id, 0, 0, false);
+            print_set_msg_if_debug(func_name, id, set_not_present_msg());
+            return false;
+        }
+        else {
+            enc_value_t &enc_value = thread_enc_value();
+            encrypt_value(value, key, enc_value.value);
+            enc_value.hash = std::hash<string>()(enc_value.value);
+
+            bool present = val_func(*set, enc_value);
+            bool result = present ? res_pair.first : res_pair.second;
+            trace(op, id, enc_value.hash, enc_value.value.size(), result);
+
+            if (debug) {
+                stringstream msg;
+                msg << ", " << cypher(enc_value.value)
+                    << (present ? msg_pair.first : msg_pair.second);
+                print_set_msg_if_debug(func_name, id, msg.str());
+            }
+
+            return result;
+        }
+    }
+
+
+    /** @brief Perform specified value operation on a batch of values and print
+     * diagnostic messages if debug mode is on.
+     * Resolve set with given id once, encrypt and hash all values, then visit
+     * each stripe once, locking it a single time for all values belonging to it.
+     * Values of one stripe are processed in their order in @p values, so results
+     * are the same as of calling single value operation on each value in turn.
+     * @param func_name - name of the function that invoked this function.
+     * @param op - kind of operation recorded in the trace for each value.
+     * @param id - identifier of a set on which value operation is to be
+     *             performed.
+     * @param values - array of values on which operation is to be performed.
+     * @param n - number of values in @p values.
+     * @param key - key used to encrypt passed values.
+     * @param msg_pair - @p msg_pair_t pair carrying diagnostic string messages,
+     *                   as in @p handle_value_operation.
+     * @param batch_op - @p batch_op_t description of operation to perform.
+     * @param res_pair - @p res_pair_t pair carrying results for single values,
+     *                   as in @p handle_value_operation.
+     * @param results - array of @p n results for single values or @p nullptr.
+     * @return Number of values whose result is @p true.
+     */
+    size_t handle_values_operation(string_view func_name,
+                                   jnp1::encstrset_trace_op op, unsigned long id,
+                                   const char *const *values, size_t n,
+                                   const char *key, const msg_pair_t &msg_pair,
+                                   const batch_op_t &batch_op,
+                                   const res_pair_t res_pair, bool *results) {
+        if (debug) {
+            cerr() << func_name << "(" << id << ", {";
+            for (size_t i = 0; i < n; i++) {
+                cerr() << (i > 0 ? ", " : "") << string_repr(values[i]);
+            }
+            cerr() << "}, " << string_repr(key) << ")" << endl;
+        }
+
+        if (results != nullptr) {
+            std::fill(results, results + n, false);
+        }
+
+        epoch_guard_t guard;
+        enc_set_t *set = find_set(id);
+        if (set == nullptr) {
+            for (size_t i = 0; i < n; i++) {
+                trace(op, id, 0, 0, false);
+            }
+            print_set_msg_if_debug(func_name, id, set_not_present_msg());
+            return 0;
+        }
+
+        std::vector<enc_value_t> enc_values(n);
+        std::array<size_t, stripe_count + 1> stripe_begin{};
+        for (size_t i = 0; i < n; i++) {
+            if (values[i] != nullptr) {
+                encrypt_value(values[i], key, enc_values[i].value);
+                enc_values[i].hash = std::hash<string>()(enc_values[i].value);
+                stripe_begin[stripe_index(enc_values[i].hash) + 1]++;
+            }
+        }
+
+        // Indices of values grouped by stripe, each group in input order.
+        for (size_t i = 0; i < stripe_count; i++) {
+            stripe_begin[i + 1] += stripe_begin[i];
+        }
+        std::vector<size_t> order(stripe_begin[stripe_count]);
+        std::array<size_t, stripe_count> stripe_end;
+        std::copy(stripe_begin.begin(), stripe_begin.end() - 1, stripe_end.begin());
+        for (size_t i = 0; i < n; i++) {
+            if (values[i] != nullptr) {
+                order[stripe_end[stripe_index(enc_values[i].hash)]++] = i;
+            }
+        }
+
+        size_t succeeded = 0;
+        for (size_t s = 0; s < stripe_count; s++) {
+            if (stripe_begin[s] == stripe_begin[s + 1]) {
+                continue;
+            }
+
+            enc_stripe_t &stripe = set->stripes[s];
+            std::unique_lock<std::shared_mutex> write_lock(stripe.mutex, std::defer_lock);
+            std::shared_lock<std::shared_mutex> read_lock(stripe.mutex, std::defer_lock);
+            if (batch_op.exclusive) {
+                write_lock.lock();
+            }
+            else {
+                read_lock.lock();
+            }
+
+            bool reserved = !batch_op.adds;
+            // Values a few positions ahead are prefetched to overlap cache misses.
+            constexpr size_t prefetch_distance = 4;
+            for (size_t j = stripe_begin[s]; j < stripe_begin[s + 1]; j++) {
+                if (j + prefetch_distance < stripe_begin[s + 1] && stripe.table != nullptr) {
+                    stripe.table->prefetch(enc_values[order[j + prefetch_distance]].hash);
+                }
+
+                size_t i = order[j];
+                // Table is made writable and reserved for the rest of the group
+                // only at the first absent value, so that a batch of present
+                // values does not copy a table shared with a set copy.
+                if (!reserved && !stripe.contains(enc_values[i])) {
+                    flat_table_t &table = stripe.writable();
+                    table.reserve(table.size() + stripe_begin[s + 1] - j);
+                    reserved = true;
+                }
+                bool present = batch_op.func(stripe, enc_values[i]);
+                bool result = present ? res_pair.first : res_pair.second;
+
+                if (results != nullptr) {
+                    results[i] = result;
+                }
+                succeeded += result;
+                trace(op, id, enc_values[i].hash, enc_values[i].value.size(), result);
+
+                if (debug) {
+                    stringstream msg;
+                    msg << ", " << cypher(enc_values[i].value)
+                        << (present ? msg_pair.first : msg_pair.second);
+                    print_set_msg_if_debug(func_name, id, msg.str());
+                }
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (values[i] == nullptr) {
+                trace(op, id, 0, 0, false);
+                print_func_msg_if_debug(func_name, ": invalid value (NULL)");
+            }
+        }
+
+        return succeeded;
+    }
+
+
+    /**
+     * Arguments of operation combining two sets, used in diagnostic messages.
+     */
+    struct combine_args_t {
+        string_view func_name;
+        unsigned long src_id;
+        unsigned long dst_id;
+    };
+
+    /**
+     * Function combining table of source stripe, possibly @p nullptr, into
+     * exclusively locked corresponding stripe of destination set. Returns
+     * number of values added to or removed from destination stripe.
+     */
+    using combine_func_t = size_t (*)(const std::shared_ptr<const flat_table_t> &,
+                                      enc_stripe_t &, const combine_args_t &);
+
+    /** @brief Print diagnostic message about copied value if debug mode is on.
+     * @param data - bytes of copied encrypted value.
+     * @param length - length of copied encrypted value.
+     * @param added - whether value was added to destination set.
+     * @param args - arguments of the operation copying the value.
+     */
+    void print_copy_msg_if_debug(const char *data, uint32_t length, bool added,
+                                 const combine_args_t &args) {
+        if (debug) {
+            string value(data, length);
+            stringstream msg;
+            msg << ": ";
+
+            if (added) {
+                msg << cypher(value) << " copied from " << set_id_msg()
+                    << args.src_id << " to " << set_id_msg() << args.dst_id;
+            }
+            else {
+                msg << "copied " << cypher(value)
+                    << " was already present in " << set_id_msg() << args.dst_id;
+            }
+
+            print_func_msg_if_debug(args.func_name, msg.str());
+        }
+    }
+
+    /** @brief Print diagnostic message about value removed from destination
+     * set if debug mode is on.
+     * @param data - bytes of removed encrypted value.
+     * @param length - length of removed encrypted value.
+     * @param args - arguments of the operation removing the value.
+     */
+    void print_removal_msg_if_debug(const char *data, uint32_t length,
+                                    const combine_args_t &args) {
+        if (debug) {
+            stringstream msg;
+            msg << ", " << cypher(string(data, length)) << " removed";
+            print_set_msg_if_debug(args.func_name, args.dst_id, msg.str());
+        }
+    }
+
+    /** @brief Replace table of locked stripe with given one.
+     * @param dst - exclusively locked stripe.
+     * @param table - new table of the stripe.
+     */
+    void replace_table(enc_stripe_t &dst, std::shared_ptr<flat_table_t> table) {
+        dst.size.store(table->size(), std::memory_order_relaxed);
+        if (table->size() == 0) {
+            dst.table.reset();
+        }
+        else {
+            dst.table = std::move(table);
+        }
+        dst.filter_replaced();
+    }
+
+    /** @brief Add all values of source table to destination stripe.
+     * Empty destination stripe shares source table until either of them
+     * is modified. Otherwise destination table is reserved for all values
+     * of both and values are merged into it.
+     * @param values - table of source stripe.
+     * @param dst - exclusively locked destination stripe.
+     * @param args - arguments of the operation.
+     * @return Number of values added to @p dst.
+     */
+    size_t union_stripe(const std::shared_ptr<const flat_table_t> &values,
+                        enc_stripe_t &dst, const combine_args_t &args) {
+        if (values == nullptr || values->size() == 0) {
+            return 0;
+        }
+
+        if (values == dst.table) {
+            if (debug) {
+                values->for_each([&](const char *data, uint32_t length, size_t) {
+                    print_copy_msg_if_debug(data, length, false, args);
+                });
+            }
+            return 0;
+        }
+
+        if (dst.table == nullptr || dst.table->size() == 0) {
+            dst.table = values;
+            dst.size.store(values->size(), std::memory_order_relaxed);
+            dst.filter_replaced();
+            if (debug) {
+                values->for_each([&](const char *data, uint32_t length, size_t) {
+                    print_copy_msg_if_debug(data, length, true, args);
+                });
+            }
+            return values->size();
+        }
+
+        flat_table_t &table = dst.writable();
+        size_t previous = table.size();
+        table.reserve(table.size() + values->size());
+        values->for_each([&](const char *data, uint32_t length, size_t hash) {
+            bool added = table.insert(data, length, hash);
+            if (added) {
+                dst.filter_inserted(hash);
+            }
+            print_copy_msg_if_debug(data, length, added, args);
+        });
+        dst.size.store(table.size(), std::memory_order_relaxed);
+        return table.size() - previous;
+    }
+
+    /** @brief Keep in destination stripe only values present in source table.
+     * Smaller of the two tables is iterated and its values are looked up
+     * by their stored hashes in the larger one. Values present in both form
+     * a new table of destination stripe.
+     * @param values - table of source stripe.
+     * @param dst - exclusively locked destination stripe.
+     * @param args - arguments of the operation.
+     * @return Number of values removed from @p dst.
+     */
+    size_t intersect_stripe(const std::shared_ptr<const flat_table_t> &values,
+                            enc_stripe_t &dst, const combine_args_t &args) {
+        if (dst.table == nullptr || values == dst.table) {
+            return 0;
+        }
+
+        const flat_table_t &current = *dst.table;
+        auto kept = std::make_shared<flat_table_t>();
+        if (values != nullptr) {
+            bool src_smaller = values->size() < current.size();
+            const flat_table_t &smaller = src_smaller ? *values : current;
+            const flat_table_t &larger = src_smaller ? current : *values;
+            smaller.for_each([&](const char *data, uint32_t length, size_t hash) {
+                if (larger.contains(data, length, hash)) {
+                    kept->insert_absent(data, length, hash);
+                }
+            });
+        }
+
+        size_t removed = current.size() - kept->size();
+        if (removed == 0) {
+            return 0;
+        }
+
+        if (debug) {
+            current.for_each([&](const char *data, uint32_t length, size_t hash) {
+                if (!kept->contains(data, length, hash)) {
+                    print_removal_msg_if_debug(data, length, args);
+                }
+            });
+        }
+        replace_table(dst, std::move(kept));
+        return removed;
+    }
+
+    /** @brief Remove from destination stripe all values of source table.
+     * If source table is smaller, its values are erased from destination
+     * table. Otherwise values of destination table absent from source form
+     * its new table. Either way smaller table is iterated and values are
+     * looked up by their stored hashes in the larger one.
+     * @param values - table of source stripe.
+     * @param dst - exclusively locked destination stripe.
+     * @param args - arguments of the operation.
+     * @return Number of values removed from @p dst.
+     */
+    size_t difference_stripe(const std::shared_ptr<const flat_table_t> &values,
+                             enc_stripe_t &dst, const combine_args_t &args) {
+        if (dst.table == nullptr || values == nullptr) {
+            return 0;
+        }
+
+        size_t removed = 0;
+        if (values->size() < dst.table->size()) {
+            values->for_each([&](const char *data, uint32_t length, size_t hash) {
+                // Immutable table is copied only if there is a value to erase.
+                if (dst.table->contains(data, length, hash)) {
+                    dst.writable().erase(data, length, hash);
+                    dst.filter_erased();
+                    print_removal_msg_if_debug(data, length, args);
+                    removed++;
+                }
+            });
+            dst.size.fetch_sub(removed, std::memory_order_relaxed);
+            return removed;
+        }
+
+        const flat_table_t &current = *dst.table;
+        auto kept = std::make_shared<flat_table_t>();
+        current.for_each([&](const char *data, uint32_t length, size_t hash) {
+            if (values->contains(data, length, hash)) {
+                print_removal_msg_if_debug(data, length, args);
+                removed++;
+            }
+            else {
+                kept->insert_absent(data, length, hash);
+            }
+        });
+
+        if (removed > 0) {
+            replace_table(dst, std::move(kept));
+        }
+        return removed;
+    }
+
+    /** @brief Call given function with index of every stripe.
+     * Stripes are distributed among at most @p stripe_count threads if they
+     * hold enough values in total, as set by @p encstrset_set_parallelism. In debug mode they are always
+     * visited in order by the calling thread, so that diagnostic messages
+     * are not interleaved.
+     * @param values - number of values held by stripes.
+     * @param func - function taking index of stripe.
+     */
+    template <typename func_t>
+    void for_each_stripe(const size_t values, func_t func) {
+        size_t threads = 1;
+        const parallelism_t &settings = parallelism();
+        if (!debug && values >= settings.min_values.load(std::memory_order_relaxed)) {
+            unsigned max_threads = settings.max_threads.load(std::memory_order_relaxed);
+            if (max_threads == 0) {
+                max_threads = std::thread::hardware_concurrency();
+            }
+            threads = std::min<size_t>(max_threads, stripe_count);
+        }
+
+        if (threads <= 1) {
+            for (size_t i = 0; i < stripe_count; i++) {
+                func(i);
+            }
+            return;
+        }
 
-    /** @brief Print message when performing set operation.
-     * @param func_name - name of the function where set operation is performed.
-     * @param id - set identifier.
-     * @param msg - message to print.
-     */
-    inline void print_set_msg_if_debug(const string &func_name,
-                                       unsigned long id, const string &msg) {
-        if (debug) {
-            cerr() << func_name << ": " << set_id_msg() << id << msg << endl;
+        std::atomic<size_t> next{0};
+        auto worker = [&] {
+            for (size_t i = next.fetch_add(1); i < stripe_count; i = next.fetch_add(1)) {
+                func(i);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; t++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (std::thread &thread : workers) {
+            thread.join();
         }
     }
 
-    /** @brief Print message when invoking function.
-     * @param func_name - name of the invoked function.
-     * @param msg - message to print.
+    /** @brief Combine one set into another stripe by stripe and print
+     * diagnostic messages if debug mode is on.
+     * Values of corresponding stripes of both sets have the same hashes modulo
+     * stripe selection, so stripes are combined independently. Source table
+     * is taken by reference under shared lock of source stripe, which makes it
+     * immutable, and the lock is released before destination stripe is locked,
+     * so that concurrent operations in both directions cannot deadlock.
+     * @param func_name - name of the function that invoked this function.
+     * @param op - kind of operation recorded in the trace.
+     * @param src_id - id of a set combined into the other one.
+     * @param dst_id - id of a set being modified.
+     * @param func - @p combine_func_t function combining single stripe.
+     * @return Number of values added to or removed from destination set,
+     * 0 if either set does not exist.
      */
-    inline void print_func_msg_if_debug(const string &func_name,
-                                        const string &msg) {
-        if (debug) {
-            cerr() << func_name << msg << endl;
+    size_t combine_sets(string_view func_name, jnp1::encstrset_trace_op op,
+                        unsigned long src_id, unsigned long dst_id,
+                        combine_func_t func) {
+        print_func_call_if_debug(func_name, src_id, dst_id);
+
+        epoch_guard_t guard;
+        enc_set_t *src = find_set(src_id);
+        enc_set_t *dst = find_set(dst_id);
+        if (src == nullptr || dst == nullptr) {
+            trace(op, dst_id, src_id, 0, false);
+            print_set_msg_if_debug(func_name, src == nullptr ? src_id : dst_id,
+                                   set_not_present_msg());
+            return 0;
+        }
+
+        const combine_args_t args{func_name, src_id, dst_id};
+        std::array<size_t, stripe_count> changed{};
+        for_each_stripe(src->size() + dst->size(), [&](size_t i) {
+            std::shared_ptr<const flat_table_t> values;
+            {
+                std::shared_lock<std::shared_mutex> lock(src->stripes[i].mutex);
+                values = src->stripes[i].table;
+            }
+            std::unique_lock<std::shared_mutex> lock(dst->stripes[i].mutex);
+            changed[i] = func(values, dst->stripes[i], args);
+        });
+
+        size_t total = 0;
+        for (size_t count : changed) {
+            total += count;
         }
+        trace(op, dst_id, src_id, total, true);
+        return total;
     }
 
-    /** @brief Wrapper function of @p enc_set_t member function @p clear.
-     * Invoke member function @p clear on @p enc_set_t set with given id passed,
-     * which clears set with given identifier.
-     * Function assumes that set with given id exists.
-     * @param id - identifier of a set whose member function @p clear is
-     *             to be called.
+    /** @brief Add statistics of given set to given ones.
+     * Stripes are locked shared one at a time, so statistics of a set modified
+     * concurrently are consistent only within each stripe. Tables shared by
+     * copies of the set are counted in full in each of them.
+     * @param set - set whose statistics are added.
+     * @param out - statistics to be updated, except for @p load_factor.
+     * @param capacity - total number of table slots to be updated.
      */
-    void clear_set(unsigned long id) {
-        id_to_enc_set()[id].clear();
+    void add_set_stats(enc_set_t &set, jnp1::encstrset_stats &out, size_t &capacity) {
+        out.sets++;
+        out.overhead_bytes += sizeof(enc_set_t);
+        for (enc_stripe_t &stripe : set.stripes) {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            out.elements += stripe.size.load(std::memory_order_relaxed);
+            if (stripe.table != nullptr) {
+                table_stats_t table = stripe.table->stats();
+                out.payload_bytes += table.payload_bytes;
+                out.overhead_bytes += table.overhead_bytes;
+                out.longest_probe = std::max<size_t>(out.longest_probe, table.longest_probe);
+                capacity += table.capacity;
+            }
+            if (stripe.filter != nullptr) {
+                out.overhead_bytes += stripe.filter->bytes();
+            }
+            out.inserts += stripe.inserts.load(std::memory_order_relaxed);
+            out.tests += stripe.tests.load(std::memory_order_relaxed);
+            out.removes += stripe.removes.load(std::memory_order_relaxed);
+            out.hits += stripe.hits.load(std::memory_order_relaxed);
+        }
     }
 
-    /** @brief Wrapper function of @p id_to_enc_set_t member function @p erase.
-     * Invoke member function @p erase on @p id_to_enc_set_t map with @p id passed,
-     * which removes set with given identifier from the map.
-     * Function assumes that set with given id exists.
-     * @param id - identifier of a set to be erased.
+    /** @brief Print statistics if debug mode is on.
+     * @param func_name - name of the function reporting statistics.
+     * @param stats - statistics to print.
      */
-    void erase_set(unsigned long id) {
-        id_to_enc_set().erase(id);
+    void print_stats_if_debug(string_view func_name, const jnp1::encstrset_stats &stats) {
+        if (debug) {
+            stringstream msg;
+            msg << ": " << stats.sets << " set(s), " << stats.elements << " element(s), "
+                << stats.payload_bytes << " payload byte(s), " << stats.overhead_bytes
+                << " overhead byte(s), load factor " << stats.load_factor
+                << ", longest probe " << stats.longest_probe << ", " << stats.inserts
+                << " insert(s), " << stats.tests << " test(s) with " << stats.hits
+                << " hit(s), " << stats.removes << " remove(s)";
+            print_func_msg_if_debug(func_name, msg.str());
+        }
     }
 
-    /** @brief Wrapper function of @p enc_set_t member function @p insert.
-     * Invoke member function @p insert on @p enc_set_t set with @p value passed,
-     * which inserts given value to set with specified id.
-     * Function assumes that set with given id exists.
-     * @param id - identifier of a set where passed value is to be inserted.
-     * @param value - value to be inserted.
+    /**
+     * Header of a file storing sets. It is followed by @p set_count
+     * @p file_set_t descriptions and arrays of their tables. Fields other than
+     * @p added_sets and @p set_count describe the build which wrote the file
+     * and must match for it to be loaded, as tables are stored as they are.
      */
-    void insert_value(unsigned long id, const string &value) {
-        id_to_enc_set()[id].insert(value);
-    }
+    struct file_header_t {
+        char magic[8];
+        uint64_t version;
+        uint64_t byte_order;
+        uint64_t hash_check;
+        uint64_t slot_size;
+        uint64_t stripes;
+        uint64_t added_sets;
+        uint64_t set_count;
+    };
 
-    /** @brief Wrapper function of @p enc_set_t member function @p erase.
-     * Invoke member function @p erase on @p enc_set_t set with @p value passed,
-     * which removed given value from the set with specified id.
-     * Function assumes that set with given id exists and contains specified value.
-     * @param id - identifier of a set from where passed value is to be removed.
-     * @param value - value to be removed.
+    /**
+     * Description of a table stored in a file. Its @p capacity control bytes
+     * start at @p offset, aligned to @p file_alignment, followed by
+     * @p capacity slots and @p records_bytes of records.
      */
-    void erase_value(unsigned long id, const string &value) {
-        id_to_enc_set()[id].erase(value);
-    }
+    struct file_table_t {
+        uint64_t capacity;
+        uint64_t count;
+        uint64_t tombstones;
+        uint64_t live_bytes;
+        uint64_t records_bytes;
+        uint64_t offset;
+    };
 
-    /** @brief Check if set with given id is present.
-     * @param id - identifier of a set whose presence it to be checked.
-     * @return @p true if set with given id is present, @p false otherwise.
+    /**
+     * Description of a set stored in a file, with its options.
      */
-    inline bool is_set_present(const unsigned long id) {
-        return id_to_enc_set().find(id) != id_to_enc_set().end();
-    }
+    struct file_set_t {
+        uint64_t id;
+        uint64_t filter_bits;
+        file_table_t stripes[stripe_count];
+    };
 
-    /** @brief Check if given encrypted value is present in the set with given id.
-     * @param id - identifier of a set where given encrypted value is to be
-     *             searched.
-     * @param enc_value - encrypted value to be searched.
-     * @return @p true if set with given id exists and contains passed encrypted
-     * value, @p false otherwise.
+    /**
+     * Tables of a set taken for saving, together with its identifier and
+     * options.
      */
-    inline bool is_value_present(const unsigned long id, const string &enc_value) {
-        return is_set_present(id) &&
-               id_to_enc_set()[id].find(enc_value) != id_to_enc_set()[id].end();
-    }
+    struct set_snapshot_t {
+        unsigned long id;
+        unsigned filter_bits;
+        std::array<std::shared_ptr<const flat_table_t>, stripe_count> tables;
+    };
 
-    /** @brief Create C++ string representation understandable by the compiler
-     * of passed C-style string.
-     * @param str - C-style string whose representation is to be created.
-     * @return string object of the form "str" if @p str is not @p nullptr,
-     * "NULL" otherwise.
+    constexpr char file_magic[8] = {'E', 'N', 'C', 'S', 'T', 'R', 'S', 'T'};
+    constexpr uint64_t file_version = 2;
+    constexpr uint64_t file_byte_order = 0x0102030405060708;
+    constexpr uint64_t file_alignment = 64;
+
+    /** @brief Header of a file describing this build.
+     * @param added_sets - number of sets ever created.
+     * @param set_count - number of sets stored in the file.
+     * @return Header of a file.
      */
-    inline string string_repr(const char *str) {
-        string enclosing = (str == nullptr ? "" : R"(")");
-        return enclosing + (str == nullptr ? "NULL" : str) + enclosing;
+    file_header_t file_header(const uint64_t added_sets, const uint64_t set_count) {
+        file_header_t header;
+        memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.byte_order = file_byte_order;
+        header.hash_check = std::hash<string>()("encstrset");
+        header.slot_size = sizeof(flat_slot_t);
+        header.stripes = stripe_count;
+        header.added_sets = added_sets;
+        header.set_count = set_count;
+        return header;
     }
 
-    /** @brief Create cyphered version of passed string.
-     * Create new string @p cyphered_string where each character of the original
-     * string is replaced with its hexadecimal representation of length two
-     * and there are spaces inserted between any two consecutive characters
-     * from the original string.
-     * @param str - string to cypher.
-     * @return Cyphered version of passed string in the form
-     * @p cypher "cyphered_string".
+    /** @brief Write whole buffer to a file descriptor.
+     * @param fd - descriptor of the file.
+     * @param data - bytes to write.
+     * @param length - number of bytes to write.
+     * @return @p true if all bytes were written, @p false otherwise.
      */
-    string cypher(const string &str) {
-        stringstream cyphered;
-        cyphered << "cypher " << '"';
-
-        size_t processed = 0;
-        for (int c : str) {
-            processed++;
-
-            cyphered << std::uppercase << std::hex << c / 16 << c % 16;
-            if (processed < str.length()) {
-                cyphered << " ";
+    bool write_all(const int fd, const char *data, size_t length) {
+        while (length > 0) {
+            ssize_t written = write(fd, data, length);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
             }
+            data += written;
+            length -= written;
         }
-
-        cyphered << '"';
-        return cyphered.str();
+        return true;
     }
 
-    /** @brief Encrypt passed value with given key.
-     * Create new string object whose content is passed value encrypted with
-     * given key. Encryption is symmetric and is done by XOR operation. If given
-     * key is shorter than the value, it is cyclically repeated. If given value
-     * is @p nullptr, empty string is returned. If given key is @p nullptr or
-     * is an empty string, no encryption is performed and copy of the passed value
-     * is returned.
-     * @param value - C-style string representing value to be encrypted.
-     * @param key - C-style string representing key to be used in encryption.
-     * @return @p string object whose content is passed value encrypted with given
-     * key or empty string if passed value is @p nullptr or string object copy
-     * of the passed value if given key is empty or is @p nullptr.
+    /** @brief Write all existing sets to a file.
+     * Tables of all sets are taken first, each under shared lock of its stripe,
+     * and written after all locks are released. File is written under
+     * temporary name, flushed to disk and renamed, so that it is replaced only
+     * when complete.
+     * @param path - path of the file.
+     * @param saved - number of saved sets.
+     * @return @p true if file was written, @p false otherwise.
      */
-    string encrypt_value(const char *value, const char *key) {
-        if (value == nullptr) {
-            return "";
-        }
-        else if (key == nullptr) {
-            return string(value);
+    bool save_sets(const char *path, size_t &saved) {
+        unsigned long added_sets = registry().added_sets.load();
+        std::vector<set_snapshot_t> sets;
+        {
+            epoch_guard_t guard;
+            for (unsigned long id = 0; id < added_sets; id++) {
+                enc_set_t *set = find_set(id);
+                if (set != nullptr) {
+                    sets.emplace_back();
+                    sets.back().id = id;
+                    for (size_t i = 0; i < stripe_count; i++) {
+                        std::shared_lock<std::shared_mutex> lock(set->stripes[i].mutex);
+                        sets.back().tables[i] = set->stripes[i].table;
+                        sets.back().filter_bits = set->stripes[i].filter_bits;
+                    }
+                }
+            }
         }
-        else {
-            string enc_value = value;
-            const string key_str = key;
-
-            if (!key_str.empty()) {
-                string::iterator iter = enc_value.begin();
-                string::const_iterator key_iter = key_str.begin();
 
-                while (iter != enc_value.end()) {
-                    *iter++ ^= *key_iter++;
+        file_header_t header = file_header(added_sets, sets.size());
+        std::vector<file_set_t> descriptions(sets.size());
+        uint64_t offset = sizeof(header) + sets.size() * sizeof(file_set_t);
+        for (size_t s = 0; s < sets.size(); s++) {
+            descriptions[s].id = sets[s].id;
+            descriptions[s].filter_bits = sets[s].filter_bits;
+            for (size_t i = 0; i < stripe_count; i++) {
+                file_table_t &description = descriptions[s].stripes[i];
+                description = {};
+                if (sets[s].tables[i] != nullptr) {
+                    mapped_table_t arrays = sets[s].tables[i]->arrays();
+                    offset = (offset + file_alignment - 1) / file_alignment * file_alignment;
+                    description = {arrays.capacity, arrays.count, arrays.tombstones,
+                                   arrays.live_bytes, arrays.records_bytes, offset};
+                    offset += arrays.capacity * (1 + sizeof(flat_slot_t)) +
+                              arrays.records_bytes;
+                }
+            }
+        }
 
-                    if (key_iter == key_str.end()) {
-                        key_iter = key_str.begin();
-                    }
+        string temporary = string(path) + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header)) &&
+                  write_all(fd, reinterpret_cast<const char *>(descriptions.data()),
+                            descriptions.size() * sizeof(file_set_t));
+        uint64_t written = sizeof(header) + descriptions.size() * sizeof(file_set_t);
+        for (size_t s = 0; s < sets.size() && ok; s++) {
+            for (size_t i = 0; i < stripe_count && ok; i++) {
+                if (sets[s].tables[i] == nullptr) {
+                    continue;
                 }
+
+                static constexpr char padding[file_alignment] = {};
+                mapped_table_t arrays = sets[s].tables[i]->arrays();
+                uint64_t offset = descriptions[s].stripes[i].offset;
+                ok = write_all(fd, padding, offset - written) &&
+                     write_all(fd, reinterpret_cast<const char *>(arrays.ctrl),
+                               arrays.capacity) &&
+                     write_all(fd, reinterpret_cast<const char *>(arrays.slots),
+                               arrays.capacity * sizeof(flat_slot_t)) &&
+                     write_all(fd, arrays.records, arrays.records_bytes);
+                written = offset + arrays.capacity * (1 + sizeof(flat_slot_t)) +
+                          arrays.records_bytes;
             }
+        }
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
 
-            return enc_value;
+        if (!ok || std::rename(temporary.c_str(), path) != 0) {
+            std::remove(temporary.c_str());
+            return false;
         }
+        saved = sets.size();
+        return true;
     }
 
-    /** @brief Perform specified set operation and print diagnostic messages
-     * if debug mode is on.
-     * Print function call that invoked this function if debug mode is on.
-     * Check if set with given is present. If so, perform specified operation
-     * and print appropriate diagnostic message if debug mode is on. Otherwise,
-     * only print appropriate diagnostic message if debug mode is on.
-     * @param func_name - name of the function that invoked this function.
-     * @param id - identifier of a set on which operation is to be performed.
-     * @param msg_pair - @p msg_pair_t pair carrying diagnostic string messages
-     *                   to be printed if debug mode is on: first one if set
-     *                   exists, second one if set does not exist.
-     * @param func_if_set_present - @p set_func_t pointer to function performing
-     *                              operation on set with given id.
+    /** @brief Check if table described in a file fits in it and is well formed.
+     * @param table - description of the table.
+     * @param size - size of the file.
+     * @return @p true if table is valid, @p false otherwise.
      */
-    void handle_set_operation(const string &func_name, unsigned long id,
-                              const msg_pair_t &msg_pair,
-                              set_func_t func_if_set_present) {
-        print_func_call_if_debug(func_name, id);
-
-        if (is_set_present(id)) {
-            func_if_set_present(id);
-            print_set_msg_if_debug(func_name, id, msg_pair.first);
-        }
-        else {
-            print_set_msg_if_debug(func_name, id, msg_pair.second);
+    bool valid_table(const file_table_t &table, const uint64_t size) {
+        if (table.capacity == 0) {
+            return table.count == 0;
         }
+
+        uint64_t max_capacity = size / (1 + sizeof(flat_slot_t));
+        return table.capacity >= 16 && (table.capacity & (table.capacity - 1)) == 0 &&
+               table.capacity <= max_capacity &&
+               table.count + table.tombstones < table.capacity &&
+               table.offset % file_alignment == 0 && table.offset <= size &&
+               table.records_bytes <= size &&
+               table.capacity * (1 + sizeof(flat_slot_t)) + table.records_bytes <=
+                   size - table.offset;
     }
 
-    /** @brief Perform specified value operations and print diagnostic messages
-     * if debug mode is on.
-     * Print function call that invoked this function if debug mode is on.
-     * Perform appropriate value operation, print appropriate diagnostic message
-     * (if debug mode is on) and return appropriate value based if passed value
-     * is present in the set with given id.
-     * @param func_name - name of the function that invoked this function.
-     * @param id - identifier of a set on which value operation is to be
-     *             performed.
-     * @param value - value on which operation is to be performed.
-     * @param key - key used to encrypt passed value.
-     * @param msg_pair - @p msg_pair_t pair carrying diagnostic string messages
-     *                   to be printed if debug mode is on: first one if passed
-     *                   value is valid C-style string and set with given id
-     *                   exists and contains encrypted value, second one if above
-     *                   conditions are true except that set with given id does not
-     *                   contain encrypted value.
-     * @param val_func_pair - @p val_func_pair_t pair carrying @p val_func_t
-     *                        pointers to functions to be called, performing value
-     *                        operations: first one if passed value is valid C-style
-     *                        string and set with given id exists and contains
-     *                        encrypted value, second one if above conditions
-     *                        are true, except that set with given id does not
-     *                        contain encrypted value.
-     * @param res_pair - @p res_pair_t pair carrying return results of type @p bool:
-     *                   first one if passed value is valid C-style string and set
-     *                   with given id exists and contains encrypted value, second
-     *                   one if above conditions are true, except that set with
-     *                   given id does not contain encrypted value.
-     * @return @p false if @p value is @p nullptr or set with given id does not
-     * exist, otherwise @p res_pair.first when set with given id contains
-     * encrypted value, otherwise @p res_pair.second.
+    /** @brief Arrays of a table stored in a mapped file.
+     * @param data - mapped file.
+     * @param table - description of the table, checked by @p valid_table.
+     * @param mapping - owner of the mapping.
+     * @return Arrays of the table.
      */
-    bool handle_value_operation(const string &func_name, unsigned long id,
-                                const char *value, const char *key,
-                                const msg_pair_t &msg_pair,
-                                const val_func_pair_t val_func_pair,
-                                const res_pair_t res_pair) {
-        if (debug) {
-            cerr() << func_name << "(" << id << ", "
-                   << string_repr(value) << ", " << string_repr(key) << ")" << endl;
-        }
+    mapped_table_t mapped_arrays(const char *data, const file_table_t &table,
+                                 const std::shared_ptr<const void> &mapping) {
+        const char *ctrl = data + table.offset;
+        const char *slots = ctrl + table.capacity;
+        const char *records = slots + table.capacity * sizeof(flat_slot_t);
+        return {reinterpret_cast<const int8_t *>(ctrl),
+                reinterpret_cast<const flat_slot_t *>(slots), records,
+                table.capacity, table.count, table.tombstones, table.live_bytes,
+                table.records_bytes, mapping};
+    }
 
-        if (value == nullptr) {
-            print_func_msg_if_debug(func_name, ": invalid value (NULL)");
+    /** @brief Restore sets from a mapped file.
+     * Whole file, including every stored table, is validated before any set
+     * is restored. Identifiers of restored sets are reserved before they are
+     * stored in the registry. Filters of restored sets are built from hashes
+     * stored in their tables.
+     * @param data - mapped file.
+     * @param size - size of the file.
+     * @param mapping - owner of the mapping, shared by restored tables.
+     * @param loaded - number of restored sets.
+     * @return @p true if sets were restored, @p false if file is invalid.
+     */
+    bool load_sets(const char *data, const uint64_t size,
+                   const std::shared_ptr<const void> &mapping, size_t &loaded) {
+        file_header_t header;
+        if (size < sizeof(header)) {
             return false;
         }
-        else if (!is_set_present(id)) {
-            print_set_msg_if_debug(func_name, id, set_not_present_msg());
+        memcpy(&header, data, sizeof(header));
+
+        file_header_t expected = file_header(header.added_sets, header.set_count);
+        if (memcmp(&header, &expected, sizeof(header)) != 0 ||
+            header.set_count > (size - sizeof(header)) / sizeof(file_set_t)) {
             return false;
         }
-        else {
-            string new_value = encrypt_value(value, key);
-
-            stringstream msg;
-            msg << ", " << cypher(new_value);
-
-            if (is_value_present(id, new_value)) {
-                if (val_func_pair.first != nullptr) {
-                    val_func_pair.first(id, new_value);
-                }
-
-                msg << msg_pair.first;
-                print_set_msg_if_debug(func_name, id, msg.str());
 
-                return res_pair.first;
+        const file_set_t *sets = reinterpret_cast<const file_set_t *>(data + sizeof(header));
+        for (size_t s = 0; s < header.set_count; s++) {
+            if (sets[s].id >= header.added_sets || sets[s].filter_bits > max_filter_bits) {
+                return false;
             }
-            else {
-                if (val_func_pair.second != nullptr) {
-                    val_func_pair.second(id, new_value);
+            for (const file_table_t &table : sets[s].stripes) {
+                if (!valid_table(table, size) ||
+                    (table.capacity > 0 &&
+                     !flat_table_t::consistent(mapped_arrays(data, table, mapping)))) {
+                    return false;
                 }
+            }
+        }
 
-                msg << msg_pair.second;
-                print_set_msg_if_debug(func_name, id, msg.str());
+        std::atomic<unsigned long> &added_sets = registry().added_sets;
+        unsigned long current = added_sets.load();
+        while (current < header.added_sets &&
+               !added_sets.compare_exchange_weak(current, header.added_sets)) {
+        }
 
-                return res_pair.second;
+        for (size_t s = 0; s < header.set_count; s++) {
+            enc_set_t *set = new enc_set_t;
+            for (size_t i = 0; i < stripe_count; i++) {
+                const file_table_t &table = sets[s].stripes[i];
+                enc_stripe_t &stripe = set->stripes[i];
+                stripe.filter_bits = sets[s].filter_bits;
+                if (table.count > 0) {
+                    stripe.table = std::make_shared<const flat_table_t>(
+                        mapped_arrays(data, table, mapping));
+                    stripe.size.store(table.count, std::memory_order_relaxed);
+                }
+                // Set is not visible to other threads yet, so it needs no lock.
+                stripe.filter_replaced();
             }
+            add_set(sets[s].id, set);
         }
-    }
 
+        loaded = header.set_count;
+        return true;
+    }
 }
 
 namespace jnp1 {
@@ -406,85 +2495,333 @@ namespace jnp1 {
             cerr() << "encstrset_new" << "()" << endl;
         }
 
-        std::unordered_set<string> new_set;
-        id_to_enc_set().insert({added_sets(), new_set});
+        unsigned long id = registry().added_sets.fetch_add(1);
+        add_set(id, new enc_set_t);
+        trace(ENCSTRSET_TRACE_NEW, id, 0, 0, true);
 
-        print_set_msg_if_debug("encstrset_new", added_sets(), " created");
+        print_set_msg_if_debug("encstrset_new", id, " created");
 
-        return added_sets()++;
+        return id;
     }
 
     void encstrset_delete(unsigned long id) {
-        handle_set_operation("encstrset_delete", id,
+        handle_set_operation("encstrset_delete", ENCSTRSET_TRACE_DELETE, id,
                              {" deleted", set_not_present_msg()}, erase_set);
+        reclaim_sets();
     }
 
     size_t encstrset_size(unsigned long id) {
         print_func_call_if_debug("encstrset_size", id);
 
-        if (!is_set_present(id)) {
+        epoch_guard_t guard;
+        const enc_set_t *set = find_set(id);
+        if (set == nullptr) {
+            trace(ENCSTRSET_TRACE_SIZE, id, 0, 0, false);
             print_set_msg_if_debug("encstrset_size", id, set_not_present_msg());
             return 0;
         }
 
-        stringstream msg;
-        msg << " contains " << id_to_enc_set()[id].size() << " element(s)";
+        size_t size = set->size();
+        trace(ENCSTRSET_TRACE_SIZE, id, 0, size, true);
 
-        print_set_msg_if_debug("encstrset_size", id, msg.str());
+        if (debug) {
+            stringstream msg;
+            msg << " contains " << size << " element(s)";
+            print_set_msg_if_debug("encstrset_size", id, msg.str());
+        }
 
-        return id_to_enc_set()[id].size();
+        return size;
     }
 
     bool encstrset_insert(unsigned long id, const char *value, const char *key) {
-        return handle_value_operation("encstrset_insert", id, value, key,
+        return handle_value_operation("encstrset_insert", ENCSTRSET_TRACE_INSERT,
+                                      id, value, key,
                                       {" was already present", " inserted"},
-                                      {nullptr, insert_value}, {false, true});
+                                      insert_value, {false, true});
     }
 
     bool encstrset_remove(unsigned long id, const char *value, const char *key) {
-        return handle_value_operation("encstrset_remove", id, value, key,
+        return handle_value_operation("encstrset_remove", ENCSTRSET_TRACE_REMOVE,
+                                      id, value, key,
                                       {" removed", " was not present"},
-                                      {erase_value, nullptr}, {true, false});
+                                      erase_value, {true, false});
     }
 
     bool encstrset_test(unsigned long id, const char *value, const char *key) {
-        return handle_value_operation("encstrset_test", id, value, key,
+        return handle_value_operation("encstrset_test", ENCSTRSET_TRACE_TEST,
+                                      id, value, key,
                                       {" is present", " is not present"},
-                                      {nullptr, nullptr}, {true, false});
+                                      find_value, {true, false});
+    }
+
+    size_t encstrset_insert_many(unsigned long id, const char *const *values,
+                                 size_t n, const char *key, bool *results) {
+        return handle_values_operation("encstrset_insert_many",
+                                       ENCSTRSET_TRACE_INSERT, id, values, n, key,
+                                       {" was already present", " inserted"},
+                                       {insert_to_stripe, true, true},
+                                       {false, true}, results);
+    }
+
+    size_t encstrset_remove_many(unsigned long id, const char *const *values,
+                                 size_t n, const char *key, bool *results) {
+        return handle_values_operation("encstrset_remove_many",
+                                       ENCSTRSET_TRACE_REMOVE, id, values, n, key,
+                                       {" removed", " was not present"},
+                                       {erase_from_stripe, true, false},
+                                       {true, false}, results);
+    }
+
+    size_t encstrset_test_many(unsigned long id, const char *const *values,
+                               size_t n, const char *key, bool *results) {
+        return handle_values_operation("encstrset_test_many",
+                                       ENCSTRSET_TRACE_TEST, id, values, n, key,
+                                       {" is present", " is not present"},
+                                       {find_in_stripe, false, false},
+                                       {true, false}, results);
     }
 
     void encstrset_clear(unsigned long id) {
-        handle_set_operation("encstrset_clear", id,
+        handle_set_operation("encstrset_clear", ENCSTRSET_TRACE_CLEAR, id,
                              {" cleared", set_not_present_msg()}, clear_set);
     }
 
     void encstrset_copy(unsigned long src_id, unsigned long dst_id) {
-        print_func_call_if_debug("encstrset_copy", src_id, dst_id);
+        combine_sets("encstrset_copy", ENCSTRSET_TRACE_COPY, src_id, dst_id,
+                     union_stripe);
+    }
+
+    size_t encstrset_union_into(unsigned long src_id, unsigned long dst_id) {
+        return combine_sets("encstrset_union_into", ENCSTRSET_TRACE_UNION,
+                            src_id, dst_id, union_stripe);
+    }
+
+    size_t encstrset_intersect(unsigned long src_id, unsigned long dst_id) {
+        return combine_sets("encstrset_intersect", ENCSTRSET_TRACE_INTERSECT,
+                            src_id, dst_id, intersect_stripe);
+    }
+
+    size_t encstrset_difference(unsigned long src_id, unsigned long dst_id) {
+        return combine_sets("encstrset_difference", ENCSTRSET_TRACE_DIFFERENCE,
+                            src_id, dst_id, difference_stripe);
+    }
+
+    void encstrset_set_parallelism(unsigned max_threads, size_t min_values) {
+        if (debug) {
+            cerr() << "encstrset_set_parallelism(" << max_threads << ", "
+                   << min_values << ")" << endl;
+        }
+
+        parallelism().max_threads.store(max_threads, std::memory_order_relaxed);
+        parallelism().min_values.store(min_values, std::memory_order_relaxed);
+    }
 
-        if (!is_set_present(src_id)) {
-            print_set_msg_if_debug("encstrset_copy", src_id, set_not_present_msg());
+    bool encstrset_set_options(unsigned long id, const encstrset_options *options) {
+        if (debug) {
+            cerr() << "encstrset_set_options(" << id << ", ";
+            if (options == nullptr) {
+                cerr() << "NULL";
+            }
+            else {
+                cerr() << "{" << options->filter_bits_per_value << "}";
+            }
+            cerr() << ")" << endl;
         }
-        else if (!is_set_present(dst_id)) {
-            print_set_msg_if_debug("encstrset_copy", dst_id, set_not_present_msg());
+
+        if (options == nullptr || options->filter_bits_per_value > max_filter_bits) {
+            print_func_msg_if_debug("encstrset_set_options", ": invalid options");
+            return false;
         }
-        else {
-            for (const string &s : id_to_enc_set()[src_id]) {
-                bool added = id_to_enc_set()[dst_id].insert(s).second;
 
-                stringstream msg;
-                msg << ": ";
+        epoch_guard_t guard;
+        enc_set_t *set = find_set(id);
+        if (set == nullptr) {
+            print_set_msg_if_debug("encstrset_set_options", id, set_not_present_msg());
+            return false;
+        }
 
-                if (added) {
-                    msg << cypher(s) << " copied from " << set_id_msg()
-                        << src_id << " to " << set_id_msg() << dst_id;
+        for_each_stripe(set->size(), [&](size_t i) {
+            enc_stripe_t &stripe = set->stripes[i];
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            if (stripe.filter_bits != options->filter_bits_per_value) {
+                stripe.filter_bits = options->filter_bits_per_value;
+                if (stripe.filter_bits == 0) {
+                    stripe.filter.reset();
                 }
                 else {
-                    msg << "copied " << cypher(s)
-                        << " was already present in " << set_id_msg() << dst_id;
+                    stripe.rebuild_filter();
                 }
+            }
+        });
+
+        print_set_msg_if_debug("encstrset_set_options", id, " options set");
+        return true;
+    }
+
+    bool encstrset_filter_stats(unsigned long id, encstrset_filter_counters *out) {
+        print_func_call_if_debug("encstrset_filter_stats", id);
+
+        epoch_guard_t guard;
+        const enc_set_t *set = find_set(id);
+        if (set == nullptr || out == nullptr) {
+            print_set_msg_if_debug("encstrset_filter_stats", id, set_not_present_msg());
+            return false;
+        }
+
+        *out = {};
+        for (const enc_stripe_t &stripe : set->stripes) {
+            out->rejected += stripe.filter_rejected.load(std::memory_order_relaxed);
+            out->passed += stripe.filter_passed.load(std::memory_order_relaxed);
+            out->false_positives +=
+                stripe.filter_false_positives.load(std::memory_order_relaxed);
+        }
+
+        if (debug) {
+            stringstream msg;
+            msg << ", filter rejected " << out->rejected << ", passed " << out->passed
+                << " with " << out->false_positives << " false positive(s)";
+            print_set_msg_if_debug("encstrset_filter_stats", id, msg.str());
+        }
+        return true;
+    }
+
+    bool encstrset_get_stats(unsigned long id, encstrset_stats *out) {
+        print_func_call_if_debug("encstrset_get_stats", id);
+
+        epoch_guard_t guard;
+        enc_set_t *set = find_set(id);
+        if (set == nullptr || out == nullptr) {
+            print_set_msg_if_debug("encstrset_get_stats", id, set_not_present_msg());
+            return false;
+        }
+
+        *out = {};
+        size_t capacity = 0;
+        add_set_stats(*set, *out, capacity);
+        out->load_factor = capacity == 0 ? 0 : double(out->elements) / capacity;
+
+        print_stats_if_debug("encstrset_get_stats", *out);
+        return true;
+    }
+
+    void encstrset_get_stats_all(encstrset_stats *out) {
+        if (debug) {
+            cerr() << "encstrset_get_stats_all" << "()" << endl;
+        }
+
+        if (out == nullptr) {
+            return;
+        }
+
+        *out = {};
+        size_t capacity = 0;
+        unsigned long added_sets = registry().added_sets.load();
+        epoch_guard_t guard;
+        for (unsigned long id = 0; id < added_sets; id++) {
+            enc_set_t *set = find_set(id);
+            if (set != nullptr) {
+                add_set_stats(*set, *out, capacity);
+            }
+        }
+        out->load_factor = capacity == 0 ? 0 : double(out->elements) / capacity;
+
+        print_stats_if_debug("encstrset_get_stats_all", *out);
+    }
+
+    void encstrset_trace_enable(bool enabled) {
+        trace_ring().enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    size_t encstrset_trace_read(unsigned long long *cursor,
+                                encstrset_trace_record *records, size_t max) {
+        trace_ring_t &ring = trace_ring();
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        uint64_t position = std::max<uint64_t>(*cursor, head > trace_capacity ?
+                                                        head - trace_capacity : 0);
 
-                print_func_msg_if_debug("encstrset_copy", msg.str());
+        size_t read = 0;
+        for (; position < head && read < max; position++) {
+            trace_slot_t &slot = ring.slots[position & (trace_capacity - 1)];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence < 2 * position + 2) {
+                // Record is still being written.
+                break;
             }
+
+            encstrset_trace_record &record = records[read];
+            record.sequence = position;
+            record.id = slot.id.load(std::memory_order_relaxed);
+            record.hash = slot.hash.load(std::memory_order_relaxed);
+            record.length = slot.length.load(std::memory_order_relaxed);
+            record.op = slot.op.load(std::memory_order_relaxed);
+            record.result = slot.result.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (sequence == 2 * position + 2 &&
+                slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                read++;
+            }
+        }
+
+        *cursor = position;
+        return read;
+    }
+
+    bool encstrset_save(const char *path) {
+        if (debug) {
+            cerr() << "encstrset_save(" << string_repr(path) << ")" << endl;
+        }
+
+        size_t saved = 0;
+        if (path == nullptr || !save_sets(path, saved)) {
+            print_func_msg_if_debug("encstrset_save", ": cannot write file");
+            return false;
+        }
+
+        if (debug) {
+            stringstream msg;
+            msg << ": " << saved << " set(s) saved";
+            print_func_msg_if_debug("encstrset_save", msg.str());
+        }
+        return true;
+    }
+
+    bool encstrset_load(const char *path) {
+        if (debug) {
+            cerr() << "encstrset_load(" << string_repr(path) << ")" << endl;
+        }
+
+        int fd = path == nullptr ? -1 : open(path, O_RDONLY);
+        struct stat status;
+        void *data = MAP_FAILED;
+        if (fd >= 0 && fstat(fd, &status) == 0 && status.st_size > 0) {
+            data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (data == MAP_FAILED) {
+            print_func_msg_if_debug("encstrset_load", ": cannot read file");
+            return false;
+        }
+
+        size_t size = status.st_size;
+        std::shared_ptr<const void> mapping(data, [size](const void *mapped) {
+            munmap(const_cast<void *>(mapped), size);
+        });
+
+        size_t loaded = 0;
+        if (!load_sets(static_cast<const char *>(data), size, mapping, loaded)) {
+            print_func_msg_if_debug("encstrset_load", ": invalid file");
+            return false;
+        }
+        reclaim_sets();
+
+        if (debug) {
+            stringstream msg;
+            msg << ": " << loaded << " set(s) loaded";
+            print_func_msg_if_debug("encstrset_load", msg.str());
         }
+        return true;
     }
 }
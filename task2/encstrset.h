@@ -68,6 +68,51 @@ namespace jnp1 {
      */
     bool encstrset_test(unsigned long id, const char *value, const char *key);
 
+    /** @brief Add encrypted values to set.
+     * Equivalent to calling @p encstrset_insert for each of @p n values in turn,
+     * but the set is looked up once and each part of it is locked once for
+     * the whole batch.
+     * @param id - identifier of a set where encrypted values are to be added.
+     * @param values - array of @p n values to encrypt and add to set.
+     * @param n - number of values.
+     * @param key - key used to encrypt values.
+     * @param results - array of @p n results of @p encstrset_insert for
+     * consecutive values, or @p NULL if they are not needed.
+     * @return Number of encrypted values successfully added.
+     */
+    size_t encstrset_insert_many(unsigned long id, const char *const *values,
+                                 size_t n, const char *key, bool *results);
+
+    /** @brief Remove encrypted values from set.
+     * Equivalent to calling @p encstrset_remove for each of @p n values in turn,
+     * but the set is looked up once and each part of it is locked once for
+     * the whole batch.
+     * @param id - identifier of a set where encrypted values are to be removed.
+     * @param values - array of @p n values to encrypt and remove from set.
+     * @param n - number of values.
+     * @param key - key used to encrypt values.
+     * @param results - array of @p n results of @p encstrset_remove for
+     * consecutive values, or @p NULL if they are not needed.
+     * @return Number of encrypted values successfully removed.
+     */
+    size_t encstrset_remove_many(unsigned long id, const char *const *values,
+                                 size_t n, const char *key, bool *results);
+
+    /** @brief Test if encrypted values are present in set with given id.
+     * Equivalent to calling @p encstrset_test for each of @p n values, but
+     * the set is looked up once and each part of it is locked once for
+     * the whole batch.
+     * @param id - identifier of a set where encrypted values are to be tested.
+     * @param values - array of @p n values to encrypt and test.
+     * @param n - number of values.
+     * @param key - key used to encrypt values.
+     * @param results - array of @p n results of @p encstrset_test for
+     * consecutive values, or @p NULL if they are not needed.
+     * @return Number of encrypted values present in specified set.
+     */
+    size_t encstrset_test_many(unsigned long id, const char *const *values,
+                               size_t n, const char *key, bool *results);
+
     /** @brief Remove all elements from set with given id.
      * @param id - identifier of a set to clear.
      */
@@ -81,6 +126,223 @@ namespace jnp1 {
      */
     void encstrset_copy(unsigned long src_id, unsigned long dst_id);
 
+    /** @brief Add all elements of first set to the other set.
+     * Equivalent to @p encstrset_copy, but returns number of added elements.
+     * Operations on large sets are performed by multiple threads.
+     * @param src_id - id of a set whose elements are to be added.
+     * @param dst_id - id of a set where elements are to be added.
+     * @return Number of elements added to set with id @p dst_id, 0 if either
+     * set does not exist.
+     */
+    size_t encstrset_union_into(unsigned long src_id, unsigned long dst_id);
+
+    /** @brief Remove from set all elements absent from the other set.
+     * Leave in set with id @p dst_id only elements present in set with id
+     * @p src_id if both sets exist. Otherwise, do nothing. Smaller of the sets
+     * is iterated and its elements are looked up in the larger one.
+     * Operations on large sets are performed by multiple threads.
+     * @param src_id - id of a set intersected with the other one.
+     * @param dst_id - id of a set where result is stored.
+     * @return Number of elements removed from set with id @p dst_id.
+     */
+    size_t encstrset_intersect(unsigned long src_id, unsigned long dst_id);
+
+    /** @brief Remove from set all elements of the other set.
+     * Remove from set with id @p dst_id all elements present in set with id
+     * @p src_id if both sets exist. Otherwise, do nothing. Smaller of the sets
+     * is iterated and its elements are looked up in the larger one.
+     * Operations on large sets are performed by multiple threads.
+     * @param src_id - id of a set whose elements are to be removed.
+     * @param dst_id - id of a set where result is stored.
+     * @return Number of elements removed from set with id @p dst_id.
+     */
+    size_t encstrset_difference(unsigned long src_id, unsigned long dst_id);
+
+    /** @brief Set when operations on whole sets use multiple threads.
+     * Operations on sets holding together at least @p min_values values split
+     * their work among @p max_threads threads, but never more than the number
+     * of independently locked parts of a set (16). By default threads are
+     * used from 65536 values on, one per hardware thread. In debug builds
+     * operations always use a single thread.
+     * @param max_threads - largest number of threads, 0 for one per hardware
+     * thread and 1 to perform operations in the calling thread only.
+     * @param min_values - number of values from which threads are used.
+     */
+    void encstrset_set_parallelism(unsigned max_threads, size_t min_values);
+
+    /**
+     * Options of a set. Field @p filter_bits_per_value is the number of bits
+     * per element of a filter rejecting most values absent from the set
+     * before the set itself is searched, or 0 if set has no filter. Filter
+     * takes this many bits of memory per element and with 10 bits rejects
+     * about 99% of absent values.
+     */
+    struct encstrset_options {
+        unsigned int filter_bits_per_value;
+    };
+
+    /**
+     * Counters of lookups of a set filter: values rejected by it, values it
+     * passed to the set, and values it passed that were absent from the set.
+     */
+    struct encstrset_filter_counters {
+        unsigned long long rejected;
+        unsigned long long passed;
+        unsigned long long false_positives;
+    };
+
+    /** @brief Set options of set with given id.
+     * Filter of the set is built or dropped as needed and is kept up to date
+     * by all operations, including @p encstrset_copy and set operations which
+     * replace contents of the set. Options belong to the set: they are saved
+     * by @p encstrset_save and restored by @p encstrset_load, but are not
+     * passed by @p encstrset_copy and set operations, whose destination set
+     * keeps its own options.
+     * @param id - identifier of a set.
+     * @param options - new options of the set; @p filter_bits_per_value must
+     * not exceed 64.
+     * @return @p true if options were set, @p false if set does not exist
+     * or options are invalid.
+     */
+    bool encstrset_set_options(unsigned long id,
+                               const struct encstrset_options *options);
+
+    /** @brief Get counters of lookups of filter of set with given id.
+     * Counters are kept since the set was created, also while it has no
+     * filter, in which case they do not change.
+     * @param id - identifier of a set.
+     * @param out - where counters are stored.
+     * @return @p true if counters were stored, @p false if set does not exist.
+     */
+    bool encstrset_filter_stats(unsigned long id,
+                                struct encstrset_filter_counters *out);
+
+    /**
+     * Statistics of a set or of all sets. Field @p sets is the number of sets
+     * described, @p elements the number of their elements, @p payload_bytes
+     * the total length of encrypted elements and @p overhead_bytes the memory
+     * taken by everything else: hash tables, element records and filters.
+     * Field @p load_factor is the ratio of elements to hash table slots and
+     * @p longest_probe the largest number of slot groups searched to find
+     * an element. Counters @p inserts, @p tests and @p removes count values
+     * passed to insert, test and remove operations, single or batch, and
+     * @p hits the tested values which were present.
+     */
+    struct encstrset_stats {
+        unsigned long sets;
+        size_t elements;
+        size_t payload_bytes;
+        size_t overhead_bytes;
+        double load_factor;
+        size_t longest_probe;
+        unsigned long long inserts;
+        unsigned long long tests;
+        unsigned long long removes;
+        unsigned long long hits;
+    };
+
+    /** @brief Get statistics of set with given id.
+     * Memory is examined element by element, so this takes time linear in the
+     * size of the set. Memory shared by copies of a set is counted in each
+     * of them. Function is not named @p encstrset_stats, as in C++ that name
+     * would hide @p struct @p encstrset_stats and force callers to spell out
+     * @p struct before the type.
+     * @param id - identifier of a set.
+     * @param out - where statistics are stored.
+     * @return @p true if statistics were stored, @p false if set does not exist.
+     */
+    bool encstrset_get_stats(unsigned long id, struct encstrset_stats *out);
+
+    /** @brief Get statistics aggregated over all existing sets.
+     * @param out - where statistics are stored.
+     */
+    void encstrset_get_stats_all(struct encstrset_stats *out);
+
+    /** @brief Save all sets to a file.
+     * Write all existing sets together with their identifiers to file at given
+     * path, replacing it only when it is complete and flushed to disk. Hash
+     * tables of the sets are written as they are, so that @p encstrset_load
+     * does not rebuild them.
+     * Each part of a set modified concurrently is saved in a consistent state.
+     * @param path - path of the file.
+     * @return @p true if sets were saved, @p false if file could not be written.
+     */
+    bool encstrset_save(const char *path);
+
+    /** @brief Load sets saved by @p encstrset_save.
+     * Map file at given path to memory and restore sets stored in it with
+     * their identifiers, replacing existing sets with the same identifiers.
+     * Sets created later get identifiers greater than all restored ones.
+     * Restored sets keep options set by @p encstrset_set_options, with filters
+     * built anew from the file. They serve lookups straight from the mapping,
+     * and each part of a set is copied to memory when it is first modified.
+     * File must not be modified while it is in use.
+     * @param path - path of the file.
+     * @return @p true if sets were loaded, @p false if file could not be
+     * mapped, was not written by a compatible build of the library or its
+     * contents are inconsistent, in which case no set is restored.
+     */
+    bool encstrset_load(const char *path);
+
+    /**
+     * Kinds of operations recorded in the trace.
+     */
+    enum encstrset_trace_op {
+        ENCSTRSET_TRACE_NEW,
+        ENCSTRSET_TRACE_DELETE,
+        ENCSTRSET_TRACE_SIZE,
+        ENCSTRSET_TRACE_INSERT,
+        ENCSTRSET_TRACE_REMOVE,
+        ENCSTRSET_TRACE_TEST,
+        ENCSTRSET_TRACE_CLEAR,
+        ENCSTRSET_TRACE_COPY,
+        ENCSTRSET_TRACE_UNION,
+        ENCSTRSET_TRACE_INTERSECT,
+        ENCSTRSET_TRACE_DIFFERENCE
+    };
+
+    /**
+     * Single operation recorded in the trace. Field @p op holds one of
+     * @p encstrset_trace_op values and @p id identifies the set operated on
+     * (destination set for operations on two sets). For insert, remove and
+     * test @p hash and @p length describe the encrypted value and @p result
+     * is the value returned for it. For size @p length is the returned size.
+     * For operations on two sets @p hash is id of the source set and @p length
+     * the number of elements added or removed. For other operations
+     * @p result tells whether the set (or both sets) existed.
+     */
+    struct encstrset_trace_record {
+        unsigned long long sequence;
+        unsigned long id;
+        unsigned long long hash;
+        size_t length;
+        unsigned char op;
+        bool result;
+    };
+
+    /** @brief Turn recording of operations in the trace on or off.
+     * Trace is off by default. When it is off, recording costs a single
+     * check of a flag per operation. Trace keeps a fixed number of the most
+     * recent operations, older ones are overwritten. Library built with
+     * @p ENCSTRSET_NO_TRACE defined records nothing.
+     * @param enabled - whether operations are to be recorded.
+     */
+    void encstrset_trace_enable(bool enabled);
+
+    /** @brief Read operations recorded in the trace.
+     * Copy up to @p max records following position @p cursor, in order of
+     * their sequence numbers, and advance @p cursor past them. Records already
+     * overwritten are skipped. Reading stops at a record that is still being
+     * written, so it may be read later.
+     * @param cursor - position to read from, 0 initially.
+     * @param records - array where at most @p max records are stored.
+     * @param max - size of @p records.
+     * @return Number of records stored in @p records.
+     */
+    size_t encstrset_trace_read(unsigned long long *cursor,
+                                struct encstrset_trace_record *records,
+                                size_t max);
+
 #ifdef __cplusplus
     }
 }
@@ -0,0 +1,422 @@
+// Authors: Kamil Zwierzchowski and Szymon Czyżmański
+
+// Benchmarks of encstrset. Results are printed to stdout as JSON, so that
+// they can be compared between versions. Build with:
+//   g++ -std=c++17 -O2 -DNDEBUG encstrset.cc encstrset_bench.cc -pthread
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include "encstrset.h"
+
+using namespace jnp1;
+
+namespace {
+    using bench_clock = std::chrono::steady_clock;
+
+    constexpr const char *key = "bench";
+
+    /**
+     * Settings from the command line.
+     */
+    struct options_t {
+        unsigned long ops = 4000000;
+        unsigned long values = 200000;
+        unsigned max_threads = 32;
+        unsigned long max_values = 0;  // 0 for the default of the mode.
+        unsigned long seed = 418510;
+    };
+
+    /** @brief Distinct values "v<k>" for k from 0 to @p n - 1.
+     */
+    std::vector<std::string> make_values(size_t n) {
+        std::vector<std::string> values;
+        values.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            values.push_back("v" + std::to_string(i));
+        }
+        return values;
+    }
+
+    /** @brief Seconds elapsed since @p start.
+     */
+    double seconds_since(bench_clock::time_point start) {
+        std::chrono::duration<double> elapsed = bench_clock::now() - start;
+        return elapsed.count();
+    }
+
+    /** @brief Run @p work(t) in @p threads threads started at the same time.
+     * @return Seconds from start of the first to end of the last thread.
+     */
+    template<typename Work>
+    double run_threads(unsigned threads, Work work) {
+        std::atomic<unsigned> ready{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) {
+            pool.emplace_back([&, t] {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                work(t);
+            });
+        }
+        while (ready.load() < threads) {
+            std::this_thread::yield();
+        }
+        auto start = bench_clock::now();
+        go.store(true, std::memory_order_release);
+        for (std::thread &thread : pool) {
+            thread.join();
+        }
+        return seconds_since(start);
+    }
+
+    /** @brief Mixed workload on a set: 90% tests, 5% inserts and 5% removes
+     * of values picked uniformly from @p values.
+     */
+    void mixed_ops(unsigned long id, const std::vector<std::string> &values,
+                   unsigned long ops, unsigned long seed) {
+        std::mt19937_64 rng(seed);
+        for (unsigned long i = 0; i < ops; i++) {
+            uint64_t r = rng();
+            const char *value = values[(r >> 8) % values.size()].c_str();
+            if (r % 100 < 90) {
+                encstrset_test(id, value, key);
+            }
+            else if (r % 100 < 95) {
+                encstrset_insert(id, value, key);
+            }
+            else {
+                encstrset_remove(id, value, key);
+            }
+        }
+    }
+
+    /** @brief Set holding every other value of @p values.
+     */
+    unsigned long half_filled_set(const std::vector<std::string> &values) {
+        unsigned long id = encstrset_new();
+        for (size_t i = 0; i < values.size(); i += 2) {
+            encstrset_insert(id, values[i].c_str(), key);
+        }
+        return id;
+    }
+
+    /**
+     * Throughput of the mixed workload for 1, 2, 4, ... up to
+     * @p max_threads threads sharing a fixed total number of operations,
+     * with all threads working on one set ("shared") and with each thread
+     * working on its own set ("own").
+     */
+    void bench_scaling(const options_t &opt) {
+        std::vector<std::string> values = make_values(opt.values);
+        std::cout << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+                  << ",\n  \"ops\": " << opt.ops << ",\n  \"values\": " << opt.values
+                  << ",\n  \"scaling\": [";
+        const char *separator = "\n";
+        for (const char *mode : {"shared", "own"}) {
+            double base = 0;
+            for (unsigned threads = 1; threads <= opt.max_threads; threads *= 2) {
+                std::vector<unsigned long> sets;
+                for (unsigned t = 0; t < (strcmp(mode, "shared") == 0 ? 1 : threads); t++) {
+                    sets.push_back(half_filled_set(values));
+                }
+                unsigned long per_thread = opt.ops / threads;
+                double seconds = run_threads(threads, [&](unsigned t) {
+                    mixed_ops(sets[t % sets.size()], values, per_thread, opt.seed + t);
+                });
+                for (unsigned long id : sets) {
+                    encstrset_delete(id);
+                }
+
+                double ops_per_second = per_thread * threads / seconds;
+                if (threads == 1) {
+                    base = ops_per_second;
+                }
+                std::cout << separator << "    {\"mode\": \"" << mode << "\", \"threads\": "
+                          << threads << ", \"seconds\": " << std::fixed
+                          << std::setprecision(4) << seconds << ", \"ops_per_second\": "
+                          << std::setprecision(0) << ops_per_second << ", \"speedup\": "
+                          << std::setprecision(2) << ops_per_second / base << "}";
+                separator = ",\n";
+            }
+        }
+        std::cout << "\n  ]\n}" << std::endl;
+    }
+
+    /**
+     * Layout of sets before the flat table: each set was an
+     * @p std::unordered_set of encrypted strings in a map keyed by set id.
+     */
+    using old_sets_t = std::unordered_map<unsigned long, std::unordered_set<std::string>>;
+
+    /** @brief Encryption as done by the old layout, into reused @p out.
+     */
+    void old_encrypt(const char *value, const char *cipher, std::string &out) {
+        out.assign(value);
+        size_t period = strlen(cipher);
+        for (size_t i = 0; i < out.size(); i++) {
+            out[i] ^= cipher[i % period];
+        }
+    }
+
+    /** @brief Bytes of heap currently allocated by malloc.
+     */
+    size_t heap_bytes() {
+        return mallinfo2().uordblks;
+    }
+
+    /** @brief @p n distinct values of lengths from 4 to 40 bytes.
+     * @param prefix - first character, distinguishing present and absent values.
+     */
+    std::vector<std::string> make_mixed_values(size_t n, char prefix, unsigned long seed) {
+        std::mt19937_64 rng(seed);
+        std::vector<std::string> values;
+        values.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            std::string v = prefix + std::to_string(i) + "-";
+            v.resize(std::max<size_t>(v.size(), 4 + rng() % 37), 'x');
+            values.push_back(std::move(v));
+        }
+        return values;
+    }
+
+    /** @brief Mean nanoseconds per call of @p lookup on values in random order.
+     */
+    template<typename Lookup>
+    double lookup_ns(const std::vector<std::string> &values, unsigned long ops,
+                     unsigned long seed, Lookup lookup) {
+        std::mt19937_64 rng(seed);
+        std::vector<const char *> order(std::min<unsigned long>(ops, 1 << 20));
+        for (const char *&value : order) {
+            value = values[rng() % values.size()].c_str();
+        }
+        size_t found = 0;
+        auto start = bench_clock::now();
+        for (unsigned long i = 0; i < ops; i++) {
+            found += lookup(order[i % order.size()]);
+        }
+        double seconds = seconds_since(start);
+        if (found == SIZE_MAX) {
+            std::cerr << found;
+        }
+        return seconds * 1e9 / ops;
+    }
+
+    /**
+     * Heap memory per element and mean latency of lookups of present
+     * ("hit") and absent ("miss") values, for sets of 10^3 up to
+     * @p max_values values of 4 to 40 bytes, in the flat table and in
+     * the old layout. Both include encryption of the looked up value.
+     */
+    void bench_memory(const options_t &opt) {
+        std::cout << "{\n  \"ops\": " << opt.ops << ",\n  \"memory\": [";
+        const char *separator = "\n";
+
+        // First call allocates per-thread buffers, which are not counted.
+        unsigned long warm = encstrset_new();
+        encstrset_insert(warm, "warm", key);
+        encstrset_delete(warm);
+
+        unsigned long max_values = opt.max_values > 0 ? opt.max_values : 1000000;
+        for (unsigned long n = 1000; n <= max_values; n *= 10) {
+            std::vector<std::string> present = make_mixed_values(n, 'p', opt.seed);
+            std::vector<std::string> absent = make_mixed_values(n, 'a', opt.seed + 1);
+
+            size_t before = heap_bytes();
+            unsigned long id = encstrset_new();
+            for (const std::string &v : present) {
+                encstrset_insert(id, v.c_str(), key);
+            }
+            double flat_bytes = double(heap_bytes() - before) / n;
+            double flat_hit = lookup_ns(present, opt.ops, opt.seed, [&](const char *v) {
+                return encstrset_test(id, v, key);
+            });
+            double flat_miss = lookup_ns(absent, opt.ops, opt.seed, [&](const char *v) {
+                return encstrset_test(id, v, key);
+            });
+            encstrset_delete(id);
+
+            std::string buffer;
+            before = heap_bytes();
+            old_sets_t *old_sets = new old_sets_t;
+            std::unordered_set<std::string> &old_set = (*old_sets)[id];
+            for (const std::string &v : present) {
+                old_encrypt(v.c_str(), key, buffer);
+                old_set.insert(buffer);
+            }
+            double old_bytes = double(heap_bytes() - before) / n;
+            auto old_lookup = [&](const char *v) {
+                old_encrypt(v, key, buffer);
+                auto it = old_sets->find(id);
+                return it != old_sets->end() && it->second.count(buffer) > 0;
+            };
+            double old_hit = lookup_ns(present, opt.ops, opt.seed, old_lookup);
+            double old_miss = lookup_ns(absent, opt.ops, opt.seed, old_lookup);
+            delete old_sets;
+
+            std::cout << separator << "    {\"values\": " << n << ", \"flat\": {\"bytes_per_value\": "
+                      << std::fixed << std::setprecision(1) << flat_bytes << ", \"hit_ns\": "
+                      << flat_hit << ", \"miss_ns\": " << flat_miss
+                      << "}, \"unordered_set\": {\"bytes_per_value\": " << old_bytes
+                      << ", \"hit_ns\": " << old_hit << ", \"miss_ns\": " << old_miss << "}}";
+            separator = ",\n";
+        }
+        std::cout << "\n  ]\n}" << std::endl;
+    }
+
+    /** @brief Insert values "v<k>" for k from @p first to @p last - 1 into
+     * set @p id, in batches.
+     */
+    void insert_range(unsigned long id, size_t first, size_t last) {
+        constexpr size_t batch = 1 << 16;
+        std::vector<std::string> values;
+        std::vector<const char *> pointers;
+        for (size_t begin = first; begin < last; begin += batch) {
+            values.clear();
+            pointers.clear();
+            for (size_t k = begin; k < std::min(begin + batch, last); k++) {
+                values.push_back("v" + std::to_string(k));
+            }
+            for (const std::string &v : values) {
+                pointers.push_back(v.c_str());
+            }
+            encstrset_insert_many(id, pointers.data(), pointers.size(), key, nullptr);
+        }
+    }
+
+    /**
+     * Time of union, intersection and difference of sets of n values
+     * overlapping in half, for n from 10^3 up to @p max_values (default
+     * 10^8), performed by 1, 2, 4, ... up to @p max_threads threads.
+     * Threads are used for every size, so the row with 1 thread shows from
+     * how many values splitting the work pays off, and rows with more
+     * threads how far it scales. Each operation is repeated on fresh copies
+     * until it took at least 0.2 s in total; preparing the copies is not
+     * timed. Union is done into a set built by inserts, intersection and
+     * difference into a copy of the first set.
+     */
+    void bench_setops(const options_t &opt) {
+        unsigned long max_values = opt.max_values > 0 ? opt.max_values : 100000000;
+        std::cout << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+                  << ",\n  \"setops\": [";
+        const char *separator = "\n";
+        for (unsigned long n = 1000; n <= max_values; n *= 10) {
+            unsigned long first = encstrset_new();
+            unsigned long second = encstrset_new();
+            insert_range(first, 0, n);
+            insert_range(second, n / 2, n + n / 2);
+
+            for (const char *op : {"union", "intersect", "difference"}) {
+                for (unsigned threads = 1; threads <= opt.max_threads; threads *= 2) {
+                    encstrset_set_parallelism(threads, 0);
+                    double seconds = 0;
+                    unsigned long rounds = 0;
+                    size_t changed = 0;
+                    while (seconds < 0.2) {
+                        unsigned long dst = encstrset_new();
+                        if (strcmp(op, "union") == 0) {
+                            insert_range(dst, 0, n);
+                        }
+                        else {
+                            encstrset_copy(first, dst);
+                        }
+                        auto start = bench_clock::now();
+                        if (strcmp(op, "union") == 0) {
+                            changed = encstrset_union_into(second, dst);
+                        }
+                        else if (strcmp(op, "intersect") == 0) {
+                            changed = encstrset_intersect(second, dst);
+                        }
+                        else {
+                            changed = encstrset_difference(second, dst);
+                        }
+                        seconds += seconds_since(start);
+                        rounds++;
+                        encstrset_delete(dst);
+                    }
+                    if (changed != n - n / 2) {
+                        std::cerr << op << " changed " << changed << " values of "
+                                  << n << std::endl;
+                    }
+
+                    std::cout << separator << "    {\"values\": " << n << ", \"op\": \""
+                              << op << "\", \"threads\": " << threads << ", \"ms\": "
+                              << std::fixed << std::setprecision(3)
+                              << seconds * 1000 / rounds << "}";
+                    separator = ",\n";
+                }
+            }
+            encstrset_delete(first);
+            encstrset_delete(second);
+        }
+        encstrset_set_parallelism(0, 1 << 16);
+        std::cout << "\n  ]\n}" << std::endl;
+    }
+}
+
+// Usage: encstrset_bench scaling|memory|setops [-n operations] [-v values]
+//                        [-t max threads] [-m max values] [-s seed].
+// Mode scaling measures throughput of mixed tests, inserts and removes for
+// growing numbers of threads. Mode memory compares memory per element and
+// lookup latency of the flat table with the old std::unordered_set layout.
+// Mode setops measures union, intersection and difference of growing sets
+// for growing numbers of threads; sets of 10^8 values need about 40 GB.
+int main(int argc, char *argv[]) {
+    options_t opt;
+    std::string mode = argc > 1 ? argv[1] : "";
+    optind = 2;
+    int c;
+    while (argc > 1 && (c = getopt(argc, argv, "n:v:t:m:s:")) != -1) {
+        if (c == 'n' && atol(optarg) > 0) {
+            opt.ops = atol(optarg);
+        }
+        else if (c == 'v' && atol(optarg) > 0) {
+            opt.values = atol(optarg);
+        }
+        else if (c == 't' && atoi(optarg) > 0) {
+            opt.max_threads = atoi(optarg);
+        }
+        else if (c == 'm' && atol(optarg) >= 1000) {
+            opt.max_values = atol(optarg);
+        }
+        else if (c == 's') {
+            opt.seed = strtoul(optarg, nullptr, 10);
+        }
+        else {
+            mode = "";
+            break;
+        }
+    }
+
+    if (mode == "scaling") {
+        bench_scaling(opt);
+        return 0;
+    }
+    if (mode == "memory") {
+        bench_memory(opt);
+        return 0;
+    }
+    if (mode == "setops") {
+        bench_setops(opt);
+        return 0;
+    }
+    std::cerr << "Usage: " << argv[0] << " scaling|memory|setops [-n ops] [-v values]"
+              << " [-t max_threads] [-m max_values] [-s seed]" << std::endl;
+    return 1;
+}
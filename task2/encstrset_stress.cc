@@ -0,0 +1,398 @@
+// Authors: Kamil Zwierzchowski and Szymon Czyżmański
+
+// Multi-threaded stress test of encstrset. Threads perform a random mix of
+// single and batch insert, test and remove, copy, set operations, clear,
+// delete and size on their own sets and on sets shared by all threads, and
+// check every result against a serial model of the values they put there.
+// Afterwards one set goes through a long insert and remove churn, checking that
+// its memory stays bounded.
+// Build with:
+//   g++ -std=c++17 -O2 -DNDEBUG encstrset.cc encstrset_stress.cc -pthread
+// (adding -fsanitize=thread to look for data races).
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "encstrset.h"
+
+using namespace jnp1;
+
+namespace {
+    constexpr const char *key = "stress";
+    constexpr size_t own_sets = 4;
+    constexpr size_t shared_sets = 4;
+    constexpr size_t batch = 8;
+    constexpr unsigned long churn_cycles = 1000000;
+    constexpr size_t churn_values = 64;
+    // Without compaction of erased values the churn took about 67 MB.
+    constexpr size_t churn_max_bytes = 1 << 20;
+
+    /**
+     * Settings from the command line.
+     */
+    struct options_t {
+        unsigned threads = 8;
+        unsigned long ops = 200000;
+        unsigned long values = 512;
+        unsigned long seed = 418510;
+    };
+
+    using model_t = std::set<std::string>;
+
+    std::atomic<bool> failed{false};
+    std::mutex failure_mutex;
+
+    /** @brief Report the first mismatch and stop all threads.
+     * @param thread - number of thread which found the mismatch.
+     * @param op - operation that returned an unexpected result.
+     * @param detail - description of the mismatch.
+     */
+    void fail(unsigned thread, const char *op, const std::string &detail) {
+        std::lock_guard<std::mutex> lock(failure_mutex);
+        if (!failed.exchange(true)) {
+            std::cerr << "thread " << thread << ": " << op << ": " << detail << std::endl;
+        }
+    }
+
+    /**
+     * Work of one thread. Values of thread t are "t<t>-<k>", so results for
+     * them do not depend on what other threads do, also in shared sets.
+     * Values are only moved between sets of the thread and into shared sets,
+     * so sets of the thread never contain values of other threads.
+     */
+    class worker_t {
+        const options_t &opt;
+        unsigned number;
+        std::mt19937_64 rng;
+        std::vector<unsigned long> own;
+        std::vector<model_t> own_model;
+        const std::vector<unsigned long> &shared;
+        std::vector<model_t> shared_model;
+
+        std::string value(unsigned thread) {
+            return "t" + std::to_string(thread) + "-" + std::to_string(rng() % opt.values);
+        }
+
+        /** @brief Check result of an operation, reporting a mismatch.
+         * @return Whether the result was as expected.
+         */
+        template<typename T>
+        bool expect(const char *op, T got, T expected, const std::string &detail) {
+            if (got != expected) {
+                fail(number, op, detail + ": got " + std::to_string(got) +
+                                 ", expected " + std::to_string(expected));
+                return false;
+            }
+            return true;
+        }
+
+        /** @brief Pick own or shared set together with its model.
+         * @param allow_shared - whether shared sets may be picked.
+         */
+        std::pair<unsigned long, model_t *> pick(bool allow_shared) {
+            if (allow_shared && rng() % 3 == 0) {
+                size_t i = rng() % shared.size();
+                return {shared[i], &shared_model[i]};
+            }
+            size_t i = rng() % own.size();
+            return {own[i], &own_model[i]};
+        }
+
+        void single_value_op(unsigned r) {
+            auto [id, model] = pick(true);
+            std::string v = value(number);
+            std::string what = "set " + std::to_string(id) + " value " + v;
+            if (r < 30) {
+                bool expected = model->insert(v).second;
+                expect("insert", encstrset_insert(id, v.c_str(), key), expected, what);
+            }
+            else if (r < 55) {
+                bool expected = model->count(v) > 0;
+                expect("test", encstrset_test(id, v.c_str(), key), expected, what);
+            }
+            else if (r < 60) {
+                // Own sets never hold values of other threads.
+                unsigned other = (number + 1 + rng() % opt.threads) % (opt.threads + 1);
+                std::string foreign = value(other);
+                id = own[rng() % own.size()];
+                expect("foreign test", encstrset_test(id, foreign.c_str(), key), false,
+                       "set " + std::to_string(id) + " value " + foreign);
+            }
+            else {
+                bool expected = model->erase(v) > 0;
+                expect("remove", encstrset_remove(id, v.c_str(), key), expected, what);
+            }
+        }
+
+        void batch_op(unsigned r) {
+            auto [id, model] = pick(true);
+            std::vector<std::string> values;
+            std::vector<const char *> pointers;
+            for (size_t i = 0; i < batch; i++) {
+                values.push_back(value(number));
+            }
+            for (const std::string &v : values) {
+                pointers.push_back(v.c_str());
+            }
+
+            bool results[batch];
+            size_t count;
+            const char *op;
+            std::vector<bool> expected;
+            if (r < 68) {
+                op = "insert_many";
+                for (const std::string &v : values) {
+                    expected.push_back(model->insert(v).second);
+                }
+                count = encstrset_insert_many(id, pointers.data(), batch, key, results);
+            }
+            else if (r < 72) {
+                op = "test_many";
+                for (const std::string &v : values) {
+                    expected.push_back(model->count(v) > 0);
+                }
+                count = encstrset_test_many(id, pointers.data(), batch, key, results);
+            }
+            else {
+                op = "remove_many";
+                for (const std::string &v : values) {
+                    expected.push_back(model->erase(v) > 0);
+                }
+                count = encstrset_remove_many(id, pointers.data(), batch, key, results);
+            }
+
+            size_t expected_count = 0;
+            for (size_t i = 0; i < batch; i++) {
+                expected_count += expected[i];
+                if (!expect(op, results[i], bool(expected[i]),
+                            "set " + std::to_string(id) + " value " + values[i])) {
+                    return;
+                }
+            }
+            expect(op, count, expected_count, "set " + std::to_string(id));
+        }
+
+        void two_set_op(unsigned r) {
+            size_t src = rng() % own.size();
+            auto [dst_id, dst] = pick(r < 80);
+            if (dst == &own_model[src]) {
+                return;
+            }
+            const model_t &from = own_model[src];
+            std::string what = "sets " + std::to_string(own[src]) + " -> " +
+                               std::to_string(dst_id);
+
+            if (r < 78) {
+                dst->insert(from.begin(), from.end());
+                encstrset_copy(own[src], dst_id);
+                return;
+            }
+            if (r < 80) {
+                size_t before = dst->size();
+                dst->insert(from.begin(), from.end());
+                expect("union_into", encstrset_union_into(own[src], dst_id),
+                       dst->size() - before, what);
+                return;
+            }
+            // Intersection would drop values of other threads from shared sets,
+            // so set operations removing values are done only on own sets.
+            size_t removed = 0;
+            for (auto it = dst->begin(); it != dst->end();) {
+                if ((from.count(*it) > 0) == (r < 83)) {
+                    it++;
+                }
+                else {
+                    it = dst->erase(it);
+                    removed++;
+                }
+            }
+            if (r < 83) {
+                expect("intersect", encstrset_intersect(own[src], dst_id), removed, what);
+            }
+            else {
+                expect("difference", encstrset_difference(own[src], dst_id), removed, what);
+            }
+        }
+
+        void set_op(unsigned r) {
+            size_t i = rng() % own.size();
+            std::string what = "set " + std::to_string(own[i]);
+            if (r < 90) {
+                expect("size", encstrset_size(own[i]), own_model[i].size(), what);
+            }
+            else if (r < 93) {
+                encstrset_clear(own[i]);
+                own_model[i].clear();
+            }
+            else {
+                unsigned long old = own[i];
+                encstrset_delete(old);
+                std::string v = value(number);
+                expect("test after delete", encstrset_test(old, v.c_str(), key), false,
+                       "set " + std::to_string(old));
+                expect("size after delete", encstrset_size(old), size_t(0),
+                       "set " + std::to_string(old));
+                own[i] = encstrset_new();
+                own_model[i].clear();
+            }
+        }
+
+    public:
+        worker_t(const options_t &options, unsigned thread,
+                 const std::vector<unsigned long> &shared_ids)
+            : opt(options), number(thread), rng(options.seed + thread),
+              own_model(own_sets), shared(shared_ids), shared_model(shared_ids.size()) {
+            for (size_t i = 0; i < own_sets; i++) {
+                own.push_back(encstrset_new());
+            }
+        }
+
+        void run() {
+            for (unsigned long op = 0; op < opt.ops && !failed.load(); op++) {
+                unsigned r = rng() % 100;
+                if (r < 64) {
+                    single_value_op(r);
+                }
+                else if (r < 76) {
+                    batch_op(r);
+                }
+                else if (r < 86) {
+                    two_set_op(r);
+                }
+                else {
+                    set_op(r);
+                }
+            }
+        }
+
+        /** @brief Check own and shared sets after all threads have finished.
+         * @return Number of values of this thread in each shared set.
+         */
+        std::vector<size_t> check_final() {
+            for (size_t i = 0; i < own.size(); i++) {
+                expect("final size", encstrset_size(own[i]), own_model[i].size(),
+                       "set " + std::to_string(own[i]));
+                for (const std::string &v : own_model[i]) {
+                    expect("final test", encstrset_test(own[i], v.c_str(), key), true,
+                           "set " + std::to_string(own[i]) + " value " + v);
+                }
+            }
+            std::vector<size_t> sizes;
+            for (size_t i = 0; i < shared.size(); i++) {
+                for (const std::string &v : shared_model[i]) {
+                    expect("final test", encstrset_test(shared[i], v.c_str(), key), true,
+                           "set " + std::to_string(shared[i]) + " value " + v);
+                }
+                sizes.push_back(shared_model[i].size());
+            }
+            return sizes;
+        }
+    };
+
+    /** @brief Replace values of a small set one by one many times, checking
+     * with @p encstrset_get_stats that memory taken by the set stays bounded.
+     */
+    void check_churn() {
+        unsigned long id = encstrset_new();
+        auto value = [](unsigned long k) {
+            return "churn-" + std::to_string(k);
+        };
+        for (unsigned long k = 0; k < churn_values; k++) {
+            encstrset_insert(id, value(k).c_str(), key);
+        }
+
+        for (unsigned long k = 0; k < churn_cycles && !failed.load(); k++) {
+            if (!encstrset_remove(id, value(k).c_str(), key) ||
+                !encstrset_insert(id, value(k + churn_values).c_str(), key)) {
+                fail(0, "churn", "value " + value(k));
+            }
+            if (k % 4096 == 0 || k + 1 == churn_cycles) {
+                encstrset_stats stats;
+                encstrset_get_stats(id, &stats);
+                size_t bytes = stats.payload_bytes + stats.overhead_bytes;
+                if (stats.elements != churn_values || bytes > churn_max_bytes) {
+                    fail(0, "churn", "after " + std::to_string(k) + " cycles " +
+                         std::to_string(stats.elements) + " values take " +
+                         std::to_string(bytes) + " bytes");
+                }
+            }
+        }
+        encstrset_delete(id);
+    }
+}
+
+// Usage: encstrset_stress [-t threads] [-n operations per thread]
+//                         [-v values per thread] [-s seed].
+// Exits with status 1 after the first mismatch.
+int main(int argc, char *argv[]) {
+    options_t opt;
+    int c;
+    while ((c = getopt(argc, argv, "t:n:v:s:")) != -1) {
+        if (c == 't' && atoi(optarg) > 0) {
+            opt.threads = atoi(optarg);
+        }
+        else if (c == 'n' && atol(optarg) >= 0) {
+            opt.ops = atol(optarg);
+        }
+        else if (c == 'v' && atol(optarg) > 0) {
+            opt.values = atol(optarg);
+        }
+        else if (c == 's') {
+            opt.seed = strtoul(optarg, nullptr, 10);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [-t threads] [-n ops] [-v values] [-s seed]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<unsigned long> shared;
+    for (size_t i = 0; i < shared_sets; i++) {
+        shared.push_back(encstrset_new());
+    }
+
+    std::vector<worker_t> workers;
+    for (unsigned t = 0; t < opt.threads; t++) {
+        workers.emplace_back(opt, t, shared);
+    }
+    std::vector<std::thread> threads;
+    for (worker_t &w : workers) {
+        threads.emplace_back(&worker_t::run, &w);
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    std::vector<size_t> shared_sizes(shared.size());
+    for (worker_t &w : workers) {
+        std::vector<size_t> sizes = w.check_final();
+        for (size_t i = 0; i < shared.size(); i++) {
+            shared_sizes[i] += sizes[i];
+        }
+    }
+    for (size_t i = 0; i < shared.size() && !failed.load(); i++) {
+        if (encstrset_size(shared[i]) != shared_sizes[i]) {
+            fail(0, "final size", "shared set " + std::to_string(shared[i]) + ": got " +
+                 std::to_string(encstrset_size(shared[i])) + ", expected " +
+                 std::to_string(shared_sizes[i]));
+        }
+    }
+
+    check_churn();
+
+    if (failed.load()) {
+        return 1;
+    }
+    std::cout << opt.threads << " threads x " << opt.ops << " operations OK" << std::endl;
+    return 0;
+}
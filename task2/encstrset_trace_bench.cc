@@ -0,0 +1,141 @@
+// Authors: Kamil Zwierzchowski and Szymon Czyżmański
+
+// Cost of the operation trace on the hot insert and test loop. The loop is
+// timed with the trace compiled in but disabled and with the trace enabled:
+//   g++ -std=c++17 -O2 -DNDEBUG encstrset.cc encstrset_trace_bench.cc -pthread
+// and, for reference, with the trace compiled out:
+//   g++ -std=c++17 -O2 -DNDEBUG -DENCSTRSET_NO_TRACE encstrset.cc encstrset_trace_bench.cc -pthread
+// The program uses only functions present also before the trace was added,
+// so the same loop can be timed on the version from before that change:
+//   git show 541d08d~1:task2/encstrset.cc > old/encstrset.cc
+//   g++ -std=c++17 -O2 -DNDEBUG -I. old/encstrset.cc encstrset_trace_bench.cc -pthread
+// Results are printed to stdout as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "encstrset.h"
+
+namespace jnp1 {
+    extern "C" {
+        // Weak, so that the program links also with versions without the trace.
+        void encstrset_trace_enable(bool enabled) __attribute__((weak));
+        size_t encstrset_trace_read(unsigned long long *cursor,
+                                    struct encstrset_trace_record *records,
+                                    size_t max) __attribute__((weak));
+    }
+}
+
+using namespace jnp1;
+
+namespace {
+    using bench_clock = std::chrono::steady_clock;
+
+    constexpr const char *key = "bench";
+
+    /**
+     * Best times of one operation in nanoseconds.
+     */
+    struct loop_times_t {
+        double insert_ns;
+        double test_ns;
+    };
+
+    /** @brief Nanoseconds per value elapsed since @p start.
+     */
+    double ns_since(bench_clock::time_point start, size_t values) {
+        std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+        return elapsed.count() / values;
+    }
+
+    /** @brief Time inserting all @p values into a new set and testing them,
+     * keeping the best of @p rounds rounds.
+     */
+    loop_times_t time_loop(const std::vector<std::string> &values, int rounds) {
+        loop_times_t best = {1e18, 1e18};
+        for (int round = 0; round < rounds; round++) {
+            unsigned long id = encstrset_new();
+            auto start = bench_clock::now();
+            for (const std::string &v : values) {
+                encstrset_insert(id, v.c_str(), key);
+            }
+            best.insert_ns = std::min(best.insert_ns, ns_since(start, values.size()));
+
+            start = bench_clock::now();
+            size_t found = 0;
+            for (const std::string &v : values) {
+                found += encstrset_test(id, v.c_str(), key);
+            }
+            best.test_ns = std::min(best.test_ns, ns_since(start, values.size()));
+            if (found != values.size()) {
+                std::cerr << "Lost values: " << values.size() - found << std::endl;
+            }
+            encstrset_delete(id);
+        }
+        return best;
+    }
+
+    void print_times(const char *name, const loop_times_t &times) {
+        std::cout << "  \"" << name << "\": {\"insert_ns\": " << std::fixed
+                  << std::setprecision(1) << times.insert_ns << ", \"test_ns\": "
+                  << times.test_ns << "}";
+    }
+}
+
+// Usage: encstrset_trace_bench [-v values] [-r rounds].
+int main(int argc, char *argv[]) {
+    size_t count = 100000;
+    int rounds = 10;
+    int c;
+    while ((c = getopt(argc, argv, "v:r:")) != -1) {
+        if (c == 'v' && atol(optarg) > 0) {
+            count = atol(optarg);
+        }
+        else if (c == 'r' && atoi(optarg) > 0) {
+            rounds = atoi(optarg);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [-v values] [-r rounds]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::string> values;
+    for (size_t i = 0; i < count; i++) {
+        values.push_back("value-" + std::to_string(i));
+    }
+
+    std::cout << "{\n  \"values\": " << count << ",\n";
+    if (encstrset_trace_enable == nullptr || encstrset_trace_read == nullptr) {
+        print_times("before_trace", time_loop(values, rounds));
+        std::cout << "\n}" << std::endl;
+        return 0;
+    }
+
+    encstrset_trace_enable(false);
+    loop_times_t disabled = time_loop(values, rounds);
+    encstrset_trace_enable(true);
+    loop_times_t enabled = time_loop(values, rounds);
+    encstrset_trace_enable(false);
+
+    // Library built without the trace records nothing even when it is enabled.
+    unsigned long long cursor = 0;
+    encstrset_trace_record record;
+    if (encstrset_trace_read(&cursor, &record, 1) == 0) {
+        print_times("trace_compiled_out", disabled);
+    }
+    else {
+        print_times("trace_disabled", disabled);
+        std::cout << ",\n";
+        print_times("trace_enabled", enabled);
+    }
+    std::cout << "\n}" << std::endl;
+    return 0;
+}
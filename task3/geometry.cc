@@ -6,6 +6,8 @@
 
 #include <utility>
 #include <cassert>
+#include <algorithm>
+#include <limits>
 #include "geometry.h"
 
 namespace {
@@ -75,6 +77,7 @@ bool Rectangle::operator== (const Rectangle& rec) const {
 Rectangles::Rectangles(std::initializer_list<Rectangle> recs): rectans(recs) {}
 
 size_t Rectangles::size() const {return rectans.size();}
+void Rectangles::push_back(const Rectangle& rec) {rectans.push_back(rec);}
 
 Rectangle& Rectangles::operator[] (int index) {
 	assert(index >= 0 && index < (int)rectans.size()); 
@@ -94,23 +97,220 @@ bool Rectangles::operator== (const Rectangles& recs) const {
 			return false;
 	return true;
 }
+//Zwykła pętla; kompilator sam ją wektoryzuje, a ręczne wersje AVX2 i AVX-512
+//nie były szybsze (porównuje je geometry_bench.cc).
 Rectangles& Rectangles::operator+= (const Vector& vec) {
 	for(Rectangle& rec: rectans)
 		rec += vec;
 	return *this;
 }
 
+//////////////////////////RECTANGLES SOA///////////////////////////////////
+//Kolumny: 0 - x, 1 - y, 2 - szerokość, 3 - wysokość, każda o długości cap.
+
+namespace {
+
+template <typename coord>
+bool fits(fint value) {
+	return value >= std::numeric_limits<coord>::min() && value <= std::numeric_limits<coord>::max();
+}
+
+//Czy przesunięte o delta wartości kolumny nadal mieszczą się w typie coord.
+template <typename coord>
+bool fits_shifted(const coord* values, size_t count, fint delta) {
+	coord shifted;
+	return std::none_of(values, values + count, [&](coord value) {
+		return __builtin_add_overflow(value, delta, &shifted);
+	});
+}
+
+}
+
+template <typename coord>
+coord* RectanglesSoA<coord>::column(size_t c) const {return columns.get() + c * cap;}
+
+template <typename coord>
+void RectanglesSoA<coord>::set(size_t index, const Rectangle& rec) {
+	assert(fits<coord>(rec.pos().x()) && fits<coord>(rec.pos().y()));
+	assert(fits<coord>(rec.width()) && fits<coord>(rec.height()));
+	column(0)[index] = rec.pos().x();
+	column(1)[index] = rec.pos().y();
+	column(2)[index] = rec.width();
+	column(3)[index] = rec.height();
+}
+
+template <typename coord>
+Rectangle RectanglesSoA<coord>::get(size_t index) const {
+	return Rectangle(column(2)[index], column(3)[index], Position(column(0)[index], column(1)[index]));
+}
+
+template <typename coord>
+RectanglesSoA<coord>::RectanglesSoA(std::initializer_list<Rectangle> recs) {
+	reserve(recs.size());
+	for(const Rectangle& rec: recs)
+		push_back(rec);
+}
+
+template <typename coord>
+RectanglesSoA<coord>::RectanglesSoA(const Rectangles& recs) {
+	reserve(recs.size());
+	for(size_t i = 0; i < recs.size(); ++i)
+		push_back(recs[i]);
+}
+
+template <typename coord>
+RectanglesSoA<coord>::RectanglesSoA(const RectanglesSoA& recs) {
+	reserve(recs.count);
+	for(size_t c = 0; c < 4; ++c)
+		std::copy(recs.column(c), recs.column(c) + recs.count, column(c));
+	count = recs.count;
+}
+
+template <typename coord>
+RectanglesSoA<coord>::RectanglesSoA(RectanglesSoA&& recs) noexcept
+	: columns(std::move(recs.columns)), count(std::exchange(recs.count, 0)), cap(std::exchange(recs.cap, 0)) {}
+
+template <typename coord>
+RectanglesSoA<coord>& RectanglesSoA<coord>::operator= (const RectanglesSoA& recs) {
+	if(this != &recs)
+		*this = RectanglesSoA(recs);
+	return *this;
+}
+
+template <typename coord>
+RectanglesSoA<coord>& RectanglesSoA<coord>::operator= (RectanglesSoA&& recs) noexcept {
+	columns = std::move(recs.columns);
+	count = std::exchange(recs.count, 0);
+	cap = std::exchange(recs.cap, 0);
+	return *this;
+}
+
+template <typename coord>
+size_t RectanglesSoA<coord>::size() const {return count;}
+
+template <typename coord>
+void RectanglesSoA<coord>::reserve(size_t n) {
+	if(n <= cap)
+		return;
+
+	std::unique_ptr<coord[]> grown(new coord[4 * n]);
+	for(size_t c = 0; c < 4; ++c)
+		std::copy(column(c), column(c) + count, grown.get() + c * n);
+	columns = std::move(grown);
+	cap = n;
+}
+
+template <typename coord>
+void RectanglesSoA<coord>::push_back(const Rectangle& rec) {
+	if(count == cap)
+		reserve(std::max<size_t>(16, 2 * cap));
+	set(count++, rec);
+}
+
+template <typename coord>
+typename RectanglesSoA<coord>::Reference RectanglesSoA<coord>::operator[] (int index) {
+	assert(index >= 0 && index < (int)count);
+	return Reference(*this, index);
+}
+template <typename coord>
+Rectangle RectanglesSoA<coord>::operator[] (int index) const {
+	assert(index >= 0 && index < (int)count);
+	return get(index);
+}
+
+template <typename coord>
+const coord* RectanglesSoA<coord>::x() const {return column(0);}
+template <typename coord>
+const coord* RectanglesSoA<coord>::y() const {return column(1);}
+template <typename coord>
+const coord* RectanglesSoA<coord>::widths() const {return column(2);}
+template <typename coord>
+const coord* RectanglesSoA<coord>::heights() const {return column(3);}
+
+template <typename coord>
+bool RectanglesSoA<coord>::operator== (const RectanglesSoA& recs) const {
+	if(recs.count != count)
+		return false;
+
+	for(size_t c = 0; c < 4; ++c)
+		if(!std::equal(column(c), column(c) + count, recs.column(c)))
+			return false;
+	return true;
+}
+
+template <typename coord>
+RectanglesSoA<coord>& RectanglesSoA<coord>::operator+= (const Vector& vec) {
+	coord* xs = column(0);
+	coord* ys = column(1);
+	assert(fits_shifted(xs, count, vec.x()) && fits_shifted(ys, count, vec.y()));
+	const coord dx = vec.x(), dy = vec.y();
+	for(size_t i = 0; i < count; ++i)
+		xs[i] += dx;
+	for(size_t i = 0; i < count; ++i)
+		ys[i] += dy;
+	return *this;
+}
+
+template <typename coord>
+RectanglesSoA<coord>::Reference::Reference(RectanglesSoA& recs, size_t index): recs(&recs), index(index) {}
+
+template <typename coord>
+typename RectanglesSoA<coord>::Reference& RectanglesSoA<coord>::Reference::operator= (const Reference& ref) {
+	return *this = Rectangle(ref);
+}
+template <typename coord>
+typename RectanglesSoA<coord>::Reference& RectanglesSoA<coord>::Reference::operator= (const Rectangle& rec) {
+	recs->set(index, rec);
+	return *this;
+}
+template <typename coord>
+RectanglesSoA<coord>::Reference::operator Rectangle() const {return recs->get(index);}
+
+template <typename coord>
+fint RectanglesSoA<coord>::Reference::width() const {return recs->column(2)[index];}
+template <typename coord>
+fint RectanglesSoA<coord>::Reference::height() const {return recs->column(3)[index];}
+template <typename coord>
+Position RectanglesSoA<coord>::Reference::pos() const {return Position(recs->column(0)[index], recs->column(1)[index]);}
+template <typename coord>
+Rectangle RectanglesSoA<coord>::Reference::reflection() const {return Rectangle(*this).reflection();}
+template <typename coord>
+fint RectanglesSoA<coord>::Reference::area() const {return width() * height();}
+
+template <typename coord>
+typename RectanglesSoA<coord>::Reference& RectanglesSoA<coord>::Reference::operator+= (const Vector& vec) {
+	return *this = Rectangle(*this) += vec;
+}
+template <typename coord>
+Rectangle RectanglesSoA<coord>::Reference::operator+ (const Vector& vec) const {return Rectangle(*this) += vec;}
+template <typename coord>
+bool RectanglesSoA<coord>::Reference::operator== (const Rectangle& rec) const {return rec == Rectangle(*this);}
+
 /////////////////////////+ OPERATORS///////////////////////////////
 //wszystkie, które nie zostały zadeklarowane przez #define DECLARAITON(A, B)
 
 Position Vector::operator+ (const Position& pos) const {return Position(pos) += *this;}
 Rectangle Vector::operator+ (const Rectangle& rec) const {return Rectangle(rec) += *this;}
 Rectangle Rectangle::operator+ (const Vector& vec) const {return Rectangle(*this) += vec;}
-Rectangles Vector::operator+ (const Rectangles& recs) const {return Rectangles(recs) += *this;}
-Rectangles Rectangles::operator+ (const Vector& vec) const {return Rectangles(*this) += vec;}
-Rectangles operator+ (Rectangles&& recs, const Vector& vec) {return Rectangles(std::move(recs)) += vec;}
+Rectangles Vector::operator+ (const Rectangles& recs) const {return recs + *this;}
+//Wynik jest zwracany przez nazwaną zmienną, bo zwrócenie referencji z += kopiowałoby
+//go; dzięki temu wersja dla r-wartości nie alokuje pamięci.
+Rectangles Rectangles::operator+ (const Vector& vec) const {Rectangles res(*this); res += vec; return res;}
+Rectangles operator+ (Rectangles&& recs, const Vector& vec) {Rectangles res(std::move(recs)); res += vec; return res;}
 Rectangles operator+ (const Vector& vec, Rectangles&& recs) {return std::move(recs) + vec;}
 
+template <typename coord>
+RectanglesSoA<coord> RectanglesSoA<coord>::operator+ (const Vector& vec) const {RectanglesSoA res(*this); res += vec; return res;}
+template <typename coord>
+RectanglesSoA<coord> operator+ (RectanglesSoA<coord>&& recs, const Vector& vec) {RectanglesSoA<coord> res(std::move(recs)); res += vec; return res;}
+
+template class RectanglesSoA<int16_t>;
+template class RectanglesSoA<int32_t>;
+template class RectanglesSoA<int64_t>;
+template RectanglesSoA<int16_t> operator+ (RectanglesSoA<int16_t>&&, const Vector&);
+template RectanglesSoA<int32_t> operator+ (RectanglesSoA<int32_t>&&, const Vector&);
+template RectanglesSoA<int64_t> operator+ (RectanglesSoA<int64_t>&&, const Vector&);
+
 ////////////////////////MERGE////////////////////////////////////////
 
 Rectangle merge_vertically(const Rectangle& rec1, const Rectangle& rec2) {
@@ -123,6 +323,250 @@ Rectangle merge_horizontally(const Rectangle& rec1, const Rectangle& rec2) {
 	return Rectangle(rec1.width(), rec1.height() + rec2.height(), rec1.pos());
 }
 
+MergeError::MergeError(Reason reason, size_t remaining):
+	std::invalid_argument(reason == Reason::overlap ? "merge: rectangles overlap"
+			: "merge: rectangles do not form a guillotine partition of a rectangle"),
+	why(reason), left(remaining) {}
+
+MergeError::Reason MergeError::reason() const {return why;}
+size_t MergeError::remaining() const {return left;}
+
+size_t MergeTree::size() const {return nodes.size();}
+
+const MergeTree::Node& MergeTree::operator[] (size_t index) const {
+	assert(index < nodes.size());
+	return nodes[index];
+}
+
+const MergeTree::Node& MergeTree::root() const {return nodes.back();}
+
+namespace {
+
+//Kolejności prostokątów według krawędzi: lewej, prawej, dolnej i górnej.
+//Krawędź przeciwna do o to o ^ 1, a o < by_bottom to krawędzie pionowe.
+enum order {by_left, by_right, by_bottom, by_top, orders};
+
+constexpr size_t none = SIZE_MAX;
+
+fint edge(const Rectangle& rec, int o) {
+	switch(o) {
+		case by_left: return rec.pos().x();
+		case by_right: return rec.pos().x() + rec.width();
+		case by_bottom: return rec.pos().y();
+		default: return rec.pos().y() + rec.height();
+	}
+}
+
+//Obszar do podziału: granice [lo, hi) w obu osiach i leżące w nim prostokąty
+//na czterech listach dwukierunkowych, po jednej dla każdej kolejności.
+struct region
+{
+	fint lo[2], hi[2];
+	size_t head[orders], tail[orders];
+	size_t count;
+	size_t parent;
+	int side;
+};
+
+//Węzeł wewnętrzny zapisywany w chwili cięcia, więc przed swoimi dziećmi.
+//Dziecko to numer prostokąta albo n + numer innego cięcia.
+struct cut
+{
+	Rectangle rec;
+	size_t child[2];
+	MergeTree::Merge kind;
+};
+
+//Szuka cięcia obszaru prostą, która nie przecina żadnego prostokąta,
+//i dzieli go na dwa mniejsze, aż zostaną pojedyncze prostokąty.
+//Cięcia szuka się naraz od czterech stron, więc kosztuje ono tyle, ile
+//prostokątów jest po mniejszej stronie. Po tej stronie listy w tej samej
+//osi odcina się w całości, a w drugiej osi układa na nowo.
+class Slicer
+{
+		const Rectangles& recs;
+		std::vector<size_t> next[orders], prev[orders];
+		std::vector<region> todo;
+		std::vector<cut> cuts;
+		std::vector<size_t> ids;
+		std::vector<std::pair<fint, size_t>> sorted;
+
+		//Układa prostokąty z ids na liście o obszaru reg.
+		void link(int o, region& reg) {
+			sorted.clear();
+			for(size_t id : ids)
+				sorted.push_back({edge(recs[id], o), id});
+			std::sort(sorted.begin(), sorted.end());
+			for(size_t i = 0; i < sorted.size(); ++i) {
+				prev[o][sorted[i].second] = i > 0 ? sorted[i - 1].second : none;
+				next[o][sorted[i].second] = i + 1 < sorted.size() ? sorted[i + 1].second : none;
+			}
+			reg.head[o] = sorted.front().second;
+			reg.tail[o] = sorted.back().second;
+		}
+
+		void unlink(int o, region& reg, size_t id) {
+			(prev[o][id] != none ? next[o][prev[o][id]] : reg.head[o]) = next[o][id];
+			(next[o][id] != none ? prev[o][next[o][id]] : reg.tail[o]) = prev[o][id];
+		}
+
+		//Odcina count prostokątów z początku (low) albo końca listy o.
+		void cut_off(int o, region& from, region& to, size_t count, bool low) {
+			std::vector<size_t>& forward = low ? next[o] : prev[o];
+			std::vector<size_t>& backward = low ? prev[o] : next[o];
+			size_t first = low ? from.head[o] : from.tail[o];
+			size_t last = first;
+			for(size_t i = 1; i < count; ++i)
+				last = forward[last];
+			size_t rest = forward[last];
+			forward[last] = none;
+			backward[rest] = none;
+			(low ? to.head[o] : to.tail[o]) = first;
+			(low ? to.tail[o] : to.head[o]) = last;
+			(low ? from.head[o] : from.tail[o]) = rest;
+		}
+
+		[[noreturn]] void fail(const region& reg) {
+			fint area = 0;
+			for(size_t id = reg.head[by_left]; id != none; id = next[by_left][id])
+				area += recs[id].area();
+			bool overlap = area > (reg.hi[0] - reg.lo[0]) * (reg.hi[1] - reg.lo[1]);
+			throw MergeError(overlap ? MergeError::Reason::overlap : MergeError::Reason::not_mergeable, reg.count);
+		}
+
+		void attach(const region& reg, size_t child) {
+			if(reg.parent != none)
+				cuts[reg.parent].child[reg.side] = child;
+		}
+
+		void split(region reg) {
+			Rectangle whole(reg.hi[0] - reg.lo[0], reg.hi[1] - reg.lo[1], Position(reg.lo[0], reg.lo[1]));
+			if(reg.count == 1) {
+				if(!(recs[reg.head[by_left]] == whole))
+					fail(reg);
+				attach(reg, reg.head[by_left]);
+				return;
+			}
+
+			size_t at[orders];
+			fint reach[orders];
+			for(int o = 0; o < orders; ++o) {
+				at[o] = o % 2 == 0 ? reg.head[o] : reg.tail[o];
+				reach[o] = o % 2 == 0 ? std::numeric_limits<fint>::min() : std::numeric_limits<fint>::max();
+			}
+			int found = -1;
+			size_t small = 1;
+			for(; found < 0 && small < reg.count; ++small)
+				for(int o = 0; o < orders && found < 0; ++o) {
+					const Rectangle& rec = recs[at[o]];
+					if(o % 2 == 0) {
+						reach[o] = std::max(reach[o], edge(rec, o ^ 1));
+						at[o] = next[o][at[o]];
+						if(edge(recs[at[o]], o) >= reach[o])
+							found = o;
+					}
+					else {
+						reach[o] = std::min(reach[o], edge(rec, o ^ 1));
+						at[o] = prev[o][at[o]];
+						if(edge(recs[at[o]], o) <= reach[o])
+							found = o;
+					}
+				}
+			if(found < 0)
+				fail(reg);
+			--small;
+
+			int axis = found < by_bottom ? 0 : 1;
+			bool low = found % 2 == 0;
+			region part = reg;
+			part.count = small;
+			reg.count -= small;
+			(low ? part.hi : part.lo)[axis] = reach[found];
+			(low ? reg.lo : reg.hi)[axis] = reach[found];
+
+			ids.clear();
+			for(size_t id = low ? part.head[found] : part.tail[found]; ids.size() < small;
+					id = low ? next[found][id] : prev[found][id])
+				ids.push_back(id);
+			int same = 2 * axis, other = 2 - 2 * axis;
+			cut_off(same, reg, part, small, low);
+			cut_off(same + 1, reg, part, small, low);
+			for(int o = other; o < other + 2; ++o) {
+				for(size_t id : ids)
+					unlink(o, reg, id);
+				link(o, part);
+			}
+
+			size_t self = cuts.size();
+			cuts.push_back({whole, {none, none}, axis == 0 ? MergeTree::Merge::vertically : MergeTree::Merge::horizontally});
+			attach(reg, recs.size() + self);
+			part.parent = reg.parent = self;
+			part.side = low ? 0 : 1;
+			reg.side = low ? 1 : 0;
+			todo.push_back(reg);
+			todo.push_back(part);
+		}
+
+	public:
+		explicit Slicer(const Rectangles& recs): recs(recs) {}
+
+		std::vector<MergeTree::Node> run() {
+			size_t n = recs.size();
+			region all;
+			ids.resize(n);
+			for(size_t i = 0; i < n; ++i)
+				ids[i] = i;
+			for(int o = 0; o < orders; ++o) {
+				next[o].resize(n);
+				prev[o].resize(n);
+				link(o, all);
+			}
+			all.lo[0] = edge(recs[all.head[by_left]], by_left);
+			all.hi[0] = edge(recs[all.tail[by_right]], by_right);
+			all.lo[1] = edge(recs[all.head[by_bottom]], by_bottom);
+			all.hi[1] = edge(recs[all.tail[by_top]], by_top);
+			all.count = n;
+			all.parent = none;
+			all.side = 0;
+			cuts.reserve(n - 1);
+			todo.push_back(all);
+			while(!todo.empty()) {
+				region reg = todo.back();
+				todo.pop_back();
+				split(reg);
+			}
+
+			//Odwrócenie kolejności cięć stawia dzieci przed rodzicami.
+			std::vector<MergeTree::Node> nodes;
+			nodes.reserve(2 * n - 1);
+			for(size_t i = 0; i < n; ++i)
+				nodes.push_back({recs[i], MergeTree::leaf, MergeTree::leaf, MergeTree::Merge::none});
+			auto index = [&](size_t child) {return child < n ? child : n + cuts.size() - 1 - (child - n);};
+			for(size_t i = cuts.size(); i-- > 0;)
+				nodes.push_back({cuts[i].rec, index(cuts[i].child[0]), index(cuts[i].child[1]), cuts[i].kind});
+			return nodes;
+		}
+};
+
+}
+
+//Prostokąty da się scalać parami w jeden wtedy i tylko wtedy, gdy tworzą
+//podział gilotynowy, czyli gdy da się je rozcinać prostymi przez cały
+//obszar. Dowolne cięcie, które nie przecina prostokąta, jest dobre, więc
+//drzewo buduje się z góry, zaczynając od sortowania po krawędziach
+//(O(n log n)). Każde cięcie kosztuje O(k log k) dla k prostokątów po mniejszej
+//stronie, bo w drugiej osi trzeba je posortować na nowo, co dla typowych,
+//niezrównoważonych podziałów daje razem O(n log n), a w najgorszym razie
+//(zrównoważone podziały) O(n log^2 n).
+MergeTree merge_tree(const Rectangles& recs) {
+	assert(recs.size() > 0);
+	MergeTree tree;
+	tree.nodes = Slicer(recs).run();
+	return tree;
+}
+
+//Najpierw zwykłe scalanie po kolei, które nie alokuje pamięci; gdy kolejny
+//prostokąt nie sąsiaduje z dotychczasowym wynikiem, kolejność ustala merge_tree.
 Rectangle merge_all(const Rectangles& recs) {
 	assert(recs.size() > 0);
 	Rectangle merged = Rectangle(recs[0]);
@@ -133,7 +577,7 @@ Rectangle merge_all(const Rectangles& recs) {
 		else if(valid_vertically(merged, recs[i]))
 			merged = merge_vertically(merged, recs[i]);
 		else
-			throw;
+			return merge_tree(recs).root().rec;
 	}
 
 	return merged;
@@ -10,11 +10,16 @@
 #include <vector>
 #include <initializer_list>
 #include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
 
 class Vector;
 class Position;
 class Rectangle;
 class Rectangles;
+template <typename coord> class RectanglesSoA;
+class MergeTree;
 
 class Position {
 		using fint = int_fast32_t;
@@ -91,6 +96,7 @@ class Rectangles
 		Rectangles(const Rectangles& recs) = default;
 		Rectangles(Rectangles&& recs) = default;
 		size_t size() const;
+		void push_back(const Rectangle& rec);
 		Rectangle& operator[](int index);
 		const Rectangle& operator[](int index) const;
 		Rectangles& operator=(const Rectangles& rec) = default;
@@ -100,11 +106,117 @@ class Rectangles
 		Rectangles operator+(const Vector& vec) const;
 };
 
+// Prostokąty przechowywane kolumnami x, y, szerokości i wysokości, tak aby
+// operacje na wszystkich przechodziły po ciągłej pamięci. Kolumny leżą jedna
+// za drugą w jednym bloku. Typ coord określa szerokość liczb w kolumnach
+// (int16_t, int32_t albo int64_t), wartości muszą się w nim mieścić - także
+// po przesunięciu; konstruktory, przypisania, push_back i += sprawdzają to
+// asercjami, a z NDEBUG wartości spoza zakresu są obcinane.
+// Dostęp do pojedynczego prostokąta daje obiekt pośredniczący Reference.
+template <typename coord>
+class RectanglesSoA
+{
+		using fint = int_fast32_t;
+		std::unique_ptr<coord[]> columns;
+		size_t count = 0;
+		size_t cap = 0;
+		coord* column(size_t c) const;
+		void set(size_t index, const Rectangle& rec);
+		Rectangle get(size_t index) const;
+	public:
+		class Reference
+		{
+				RectanglesSoA* recs;
+				size_t index;
+			public:
+				Reference(RectanglesSoA& recs, size_t index);
+				Reference(const Reference& ref) = default;
+				Reference& operator=(const Reference& ref);
+				Reference& operator=(const Rectangle& rec);
+				operator Rectangle() const;
+				fint width() const;
+				fint height() const;
+				Position pos() const;
+				Rectangle reflection() const;
+				Reference& operator+=(const Vector& vec);
+				Rectangle operator+(const Vector& vec) const;
+				bool operator==(const Rectangle& rec) const;
+				fint area() const;
+		};
+
+		RectanglesSoA() = default;
+		RectanglesSoA(std::initializer_list<Rectangle> recs);
+		explicit RectanglesSoA(const Rectangles& recs);
+		RectanglesSoA(const RectanglesSoA& recs);
+		RectanglesSoA(RectanglesSoA&& recs) noexcept;
+		size_t size() const;
+		void reserve(size_t n);
+		void push_back(const Rectangle& rec);
+		Reference operator[](int index);
+		Rectangle operator[](int index) const;
+		const coord* x() const;
+		const coord* y() const;
+		const coord* widths() const;
+		const coord* heights() const;
+		RectanglesSoA& operator=(const RectanglesSoA& recs);
+		RectanglesSoA& operator=(RectanglesSoA&& recs) noexcept;
+		bool operator==(const RectanglesSoA& recs) const;
+		RectanglesSoA& operator+=(const Vector& vec);
+		RectanglesSoA operator+(const Vector& vec) const;
+};
+
+// Błąd scalania: prostokąty nachodzą na siebie (overlap, rozpoznawane po tym,
+// że suma ich pól przekracza pole zajmowanego obszaru) albo nie da się ich
+// scalić w jeden parami sąsiadujących prostokątów (not_mergeable). remaining
+// to liczba prostokątów w części, której nie udało się scalić.
+class MergeError : public std::invalid_argument
+{
+	public:
+		enum class Reason {overlap, not_mergeable};
+		MergeError(Reason reason, size_t remaining);
+		Reason reason() const;
+		size_t remaining() const;
+	private:
+		Reason why;
+		size_t left;
+};
+
+// Drzewo scalania. Węzły 0..n-1 to prostokąty wejściowe w kolejności z
+// Rectangles, każdy następny powstaje ze scalenia dwóch wcześniejszych
+// (first leży na lewo albo poniżej second), a ostatni jest korzeniem.
+class MergeTree
+{
+	public:
+		static constexpr size_t leaf = SIZE_MAX;
+		enum class Merge {none, vertically, horizontally};
+		struct Node
+		{
+			Rectangle rec;
+			size_t first;
+			size_t second;
+			Merge kind;
+		};
+		size_t size() const;
+		const Node& operator[](size_t index) const;
+		const Node& root() const;
+	private:
+		std::vector<Node> nodes;
+		friend MergeTree merge_tree(const Rectangles& recs);
+};
+
+template <typename coord>
+RectanglesSoA<coord> operator+ (RectanglesSoA<coord>&&, const Vector&);
 Rectangles operator+ (Rectangles&&, const Vector&);
 Rectangles operator+ (const Vector&, Rectangles&&);
 Rectangle merge_horizontally(const Rectangle& rec1, const Rectangle& rec2);
 Rectangle merge_vertically(const Rectangle& rec1, const Rectangle& rec2);
+// Scalanie prostokątów podanych w dowolnej kolejności; gdy się nie da, rzuca
+// MergeError. merge_tree działa w czasie O(n log^2 n) w najgorszym razie
+// (zrównoważone podziały), a O(n log n) dla typowych, niezrównoważonych.
+// merge_all dla prostokątów ułożonych po kolei działa w czasie O(n) bez
+// alokacji pamięci.
 Rectangle merge_all(const Rectangles& recs);
+MergeTree merge_tree(const Rectangles& recs);
 
 #endif
 
@@ -0,0 +1,188 @@
+/* Mikrobenchmark przesuwania prostokątów: geometry
+ * Autorzy:
+ * Kamil Zwierzchowski 418510
+ * Konrad Korczyński 418331
+ */
+
+//Porównuje zwykłą pętlę przesuwania prostokątów z Rectangles::operator+= z ręcznie
+//napisanymi wersjami AVX2 i AVX-512 dla 10^3 do 10^8 prostokątów; wersje, których
+//procesor nie obsługuje, są pomijane. Wyniki trafiają na standardowe wyjście jako
+//JSON. Wersje wektorowe nie okazały się szybsze od pętli, którą kompilator sam
+//wektoryzuje, więc są tylko tutaj, do ponownego porównania na innym sprzęcie.
+//Kompilacja: g++ -O2 -std=c++17 geometry_bench.cc geometry.cc
+//Wywołanie: geometry_bench [-m największa liczba prostokątów]; 10^8 prostokątów
+//zajmuje 3,2 GB pamięci.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include "geometry.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEOMETRY_X86
+#endif
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+using fint = int_fast32_t;
+
+//Prostokąt leży w pamięci jako kolejne liczby w, h, x, y typu fint, więc do
+//każdej czwórki dodaje się (0, 0, dx, dy), całymi rejestrami wektorowymi.
+//Przesuwa początkowe prostokąty z count leżących pod data i zwraca ich liczbę.
+using translate_func = size_t (*)(void* data, size_t count, fint dx, fint dy);
+
+#ifdef GEOMETRY_X86
+__attribute__((target("avx2")))
+size_t translate_avx2(void* data, size_t count, fint dx, fint dy) {
+	constexpr size_t per_vector = sizeof(__m256i) / sizeof(Rectangle);
+	fint pattern[sizeof(__m256i) / sizeof(fint)] = {};
+	for(size_t i = 0; i < per_vector; ++i) {
+		pattern[4 * i + 2] = dx;
+		pattern[4 * i + 3] = dy;
+	}
+
+	const __m256i shift = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern));
+	__m256i* vectors = static_cast<__m256i*>(data);
+	size_t n = count / per_vector;
+	for(size_t i = 0; i < n; ++i) {
+		__m256i v = _mm256_loadu_si256(vectors + i);
+		v = sizeof(fint) == 8 ? _mm256_add_epi64(v, shift) : _mm256_add_epi32(v, shift);
+		_mm256_storeu_si256(vectors + i, v);
+	}
+	return n * per_vector;
+}
+
+__attribute__((target("avx512f")))
+size_t translate_avx512(void* data, size_t count, fint dx, fint dy) {
+	constexpr size_t per_vector = sizeof(__m512i) / sizeof(Rectangle);
+	fint pattern[sizeof(__m512i) / sizeof(fint)] = {};
+	for(size_t i = 0; i < per_vector; ++i) {
+		pattern[4 * i + 2] = dx;
+		pattern[4 * i + 3] = dy;
+	}
+
+	const __m512i shift = _mm512_loadu_si512(pattern);
+	__m512i* vectors = static_cast<__m512i*>(data);
+	size_t n = count / per_vector;
+	for(size_t i = 0; i < n; ++i) {
+		__m512i v = _mm512_loadu_si512(vectors + i);
+		v = sizeof(fint) == 8 ? _mm512_add_epi64(v, shift) : _mm512_add_epi32(v, shift);
+		_mm512_storeu_si512(vectors + i, v);
+	}
+	return n * per_vector;
+}
+#endif
+
+//Czy prostokąt ma układ pól zakładany przez wersje wektorowe.
+bool vector_layout() {
+	static_assert(sizeof(Rectangle) == 4 * sizeof(fint), "Rectangle must consist of four fint fields");
+	Rectangle probe(1, 2, Position(3, 4));
+	fint fields[4];
+	std::memcpy(fields, &probe, sizeof(fields));
+	return fields[0] == 1 && fields[1] == 2 && fields[2] == 3 && fields[3] == 4;
+}
+
+//Wersja przesuwania: nazwa i funkcja, nullptr oznacza zwykłą pętlę.
+struct kernel
+{
+	const char* name;
+	translate_func func;
+};
+
+std::vector<kernel> kernels() {
+	std::vector<kernel> res = {{"scalar", nullptr}};
+#ifdef GEOMETRY_X86
+	if(!vector_layout())
+		return res;
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		res.push_back({"avx2", translate_avx2});
+	if(__builtin_cpu_supports("avx512f"))
+		res.push_back({"avx512", translate_avx512});
+#endif
+	return res;
+}
+
+//Prostokąty o różnych położeniach; i-ty leży w (i % 1000, i % 777).
+Rectangles make_rectangles(size_t n) {
+	Rectangles recs;
+	for(size_t i = 0; i < n; ++i)
+		recs.push_back(Rectangle(1 + i % 5, 1 + i % 7, Position(i % 1000, i % 777)));
+	return recs;
+}
+
+//Przesunięcie wszystkich prostokątów wskazaną wersją; zwykła pętla to
+//Rectangles::operator+=, a po wersji wektorowej przesuwa się tylko resztę.
+void translate_with(const kernel& k, Rectangles& recs, const Vector& vec) {
+	if(k.func == nullptr) {
+		recs += vec;
+		return;
+	}
+	for(size_t i = k.func(&recs[0], recs.size(), vec.x(), vec.y()); i < recs.size(); ++i)
+		recs[i] += vec;
+}
+
+//Czy po rounds przesunięciach o vec prostokąty są tam, gdzie powinny.
+bool translated(const Rectangles& recs, const Vector& vec, fint rounds) {
+	for(size_t i = 0; i < recs.size(); ++i) {
+		Rectangle expected(1 + i % 5, 1 + i % 7,
+				Position(fint(i % 1000) + rounds * vec.x(), fint(i % 777) + rounds * vec.y()));
+		if(!(recs[i] == expected))
+			return false;
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	size_t max_count = 100000000;
+	int c;
+	while((c = getopt(argc, argv, "m:")) != -1) {
+		if(c == 'm' && atoll(optarg) >= 1000) {
+			max_count = atoll(optarg);
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-m max_rectangles]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const Vector vec(3, -2);
+	const char* separator = "\n";
+	printf("{\n  \"translate\": [");
+	for(size_t n = 1000; n <= max_count; n *= 10) {
+		double scalar_ns = 0;
+		for(const kernel& k: kernels()) {
+			Rectangles recs = make_rectangles(n);
+			//Powtórzenia aż do 0,2 s, żeby małe rozmiary dało się zmierzyć.
+			fint rounds = 0;
+			std::chrono::duration<double, std::nano> elapsed(0);
+			while(elapsed.count() < 2e8) {
+				auto start = bench_clock::now();
+				translate_with(k, recs, vec);
+				elapsed += bench_clock::now() - start;
+				++rounds;
+			}
+			if(!translated(recs, vec, rounds)) {
+				fprintf(stderr, "%s: wrong result for %zu rectangles\n", k.name, n);
+				return 1;
+			}
+
+			double ns = elapsed.count() / rounds / n;
+			if(k.func == nullptr)
+				scalar_ns = ns;
+			printf("%s    {\"rectangles\": %zu, \"kernel\": \"%s\", \"ns_per_rectangle\": %.3f, "
+					"\"gb_per_second\": %.2f, \"speedup\": %.2f}", separator, n, k.name, ns,
+					2 * sizeof(Rectangle) / ns, scalar_ns / ns);
+			separator = ",\n";
+		}
+	}
+	printf("\n  ]\n}\n");
+	return 0;
+}
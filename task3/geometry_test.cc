@@ -0,0 +1,244 @@
+/* Testy: geometry
+ * Autorzy:
+ * Kamil Zwierzchowski 418510
+ * Konrad Korczyński 418331
+ */
+
+//Testy kontenera RectanglesSoA dla każdej szerokości współrzędnych oraz scalania
+//prostokątów: losowe podziały gilotynowe w losowej kolejności muszą się scalić
+//w prostokąt je obejmujący, a wiatraczek i podział z powtórzonym prostokątem
+//muszą dać MergeError z właściwym powodem.
+//Kompilacja: g++ -O2 -std=c++17 geometry_test.cc geometry.cc
+//Wywołanie: geometry_test [-n liczba podziałów] [-s ziarno]; kończy się kodem 1,
+//jeśli któryś test nie przejdzie.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "geometry.h"
+
+namespace {
+
+using fint = int_fast32_t;
+
+int failures = 0;
+
+void check(bool ok, const char* name, const char* what) {
+	if(!ok) {
+		fprintf(stderr, "%s: %s\n", name, what);
+		++failures;
+	}
+}
+
+template <typename coord>
+void test_soa(const char* name) {
+	using soa = RectanglesSoA<coord>;
+	const Rectangle a(1, 2, Position(3, 4)), b(5, 6, Position(-7, 8)), c(9, 10, Position(11, -12));
+	const Vector vec(2, -3);
+
+	//Przypisanie przez Reference kopiuje prostokąt, a nie przepina odwołania.
+	soa recs{a, b, c};
+	recs[0] = recs[2];
+	check(recs[0] == c && recs[1] == b && recs[2] == c, name, "a[i] = a[j]");
+	recs[2] = a;
+	check(recs[0] == c && recs[2] == a, name, "a[j] = rec after a[i] = a[j]");
+
+	recs[1] += vec;
+	check(recs[1] == b + vec && recs[0] == c && recs[2] == a, name, "a[i] += vec");
+	check(recs[1].pos() == b.pos() + vec && recs[1].width() == b.width(), name, "a[i] fields after +=");
+
+	recs[1] = recs[1];
+	const soa& same = recs;
+	recs = same;
+	check(recs.size() == 3 && recs[0] == c && recs[1] == b + vec && recs[2] == a, name, "self-assignment");
+
+	soa empty;
+	soa copy(empty);
+	check(copy.size() == 0 && copy == empty, name, "copy of empty");
+	soa assigned{a};
+	assigned = empty;
+	check(assigned.size() == 0 && assigned == empty, name, "assignment of empty");
+	copy.push_back(b);
+	check(copy.size() == 1 && copy[0] == b && empty.size() == 0, name, "push_back into copy of empty");
+
+	soa orig{a, b};
+	soa shifted = orig + vec;
+	check(orig[0] == a && orig[1] == b, name, "operator+ changes its argument");
+	check(shifted[0] == a + vec && shifted[1] == b + vec, name, "operator+");
+	const coord* columns = orig.x();
+	soa moved = std::move(orig) + vec;
+	check(moved.x() == columns, name, "rvalue operator+ allocates");
+	check(moved[0] == a + vec && moved[1] == b + vec, name, "rvalue operator+");
+
+	//Pierwsza rezerwacja mieści 16 prostokątów, dalej pamięć rośnie dwukrotnie.
+	soa many;
+	for(int i = 0; i < 100; ++i)
+		many.push_back(Rectangle(1 + i, 2 + i, Position(i, -i)));
+	bool grown = many.size() == 100;
+	for(int i = 0; i < 100 && grown; ++i)
+		grown = many[i] == Rectangle(1 + i, 2 + i, Position(i, -i)) && many.x()[i] == i
+				&& many.y()[i] == -i && many.widths()[i] == 1 + i && many.heights()[i] == 2 + i;
+	check(grown, name, "growth past 16");
+	soa grown_copy(many);
+	check(grown_copy == many, name, "copy after growth");
+	many += vec;
+	bool translated = true;
+	for(int i = 0; i < 100 && translated; ++i)
+		translated = many[i] == Rectangle(1 + i, 2 + i, Position(i + vec.x(), -i + vec.y()));
+	check(translated && !(grown_copy == many), name, "+= after growth");
+}
+
+//Losowy podział gilotynowy rec na co najwyżej pieces prostokątów.
+void guillotine(const Rectangle& rec, size_t pieces, std::mt19937_64& rng, std::vector<Rectangle>& out) {
+	bool across = rec.width() > 1 && (rec.height() == 1 || rng() % 2 == 0);
+	if(pieces == 1 || (rec.width() == 1 && rec.height() == 1)) {
+		out.push_back(rec);
+		return;
+	}
+
+	size_t first = 1 + rng() % (pieces - 1);
+	const Position& pos = rec.pos();
+	if(across) {
+		fint w = 1 + rng() % (rec.width() - 1);
+		guillotine(Rectangle(w, rec.height(), pos), first, rng, out);
+		guillotine(Rectangle(rec.width() - w, rec.height(), Position(pos.x() + w, pos.y())),
+				pieces - first, rng, out);
+	}
+	else {
+		fint h = 1 + rng() % (rec.height() - 1);
+		guillotine(Rectangle(rec.width(), h, pos), first, rng, out);
+		guillotine(Rectangle(rec.width(), rec.height() - h, Position(pos.x(), pos.y() + h)),
+				pieces - first, rng, out);
+	}
+}
+
+Rectangles to_rectangles(const std::vector<Rectangle>& recs) {
+	Rectangles res;
+	for(const Rectangle& rec: recs)
+		res.push_back(rec);
+	return res;
+}
+
+//Czy węzeł drzewa to scalenie swoich dzieci, sąsiadujących tak, jak mówi kind.
+bool valid_node(const MergeTree& tree, size_t i) {
+	const MergeTree::Node& node = tree[i];
+	if(node.kind == MergeTree::Merge::none)
+		return node.first == MergeTree::leaf && node.second == MergeTree::leaf;
+	if(node.first >= i || node.second >= i)
+		return false;
+
+	const Rectangle& a = tree[node.first].rec;
+	const Rectangle& b = tree[node.second].rec;
+	if(node.kind == MergeTree::Merge::vertically)
+		return a.pos().y() == b.pos().y() && a.height() == b.height()
+				&& a.pos().x() + a.width() == b.pos().x() && node.rec == merge_vertically(a, b);
+	return a.pos().x() == b.pos().x() && a.width() == b.width()
+			&& a.pos().y() + a.height() == b.pos().y() && node.rec == merge_horizontally(a, b);
+}
+
+void test_partition(const Rectangle& whole, const std::vector<Rectangle>& parts) {
+	Rectangles recs = to_rectangles(parts);
+	check(merge_all(recs) == whole, "merge_all", "result is not the bounding rectangle");
+
+	MergeTree tree = merge_tree(recs);
+	check(tree.size() == 2 * recs.size() - 1 && tree.root().rec == whole, "merge_tree", "wrong root");
+	bool leaves = true, nodes = true;
+	for(size_t i = 0; i < recs.size(); ++i)
+		leaves = leaves && tree[i].rec == recs[i];
+	for(size_t i = 0; i < tree.size(); ++i)
+		nodes = nodes && valid_node(tree, i);
+	check(leaves, "merge_tree", "leaves differ from the rectangles");
+	check(nodes, "merge_tree", "node is not a merge of its children");
+}
+
+//Sprawdza, że scalenie recs rzuca MergeError z powodem reason.
+void expect_error(const std::vector<Rectangle>& parts, MergeError::Reason reason, const char* what) {
+	Rectangles recs = to_rectangles(parts);
+	for(int call = 0; call < 2; ++call) {
+		try {
+			if(call == 0)
+				merge_all(recs);
+			else
+				merge_tree(recs);
+			check(false, what, "no MergeError");
+		}
+		catch(const MergeError& error) {
+			check(error.reason() == reason, what, "wrong MergeError reason");
+			check(error.remaining() > 1 && error.remaining() <= recs.size(), what,
+					"wrong number of remaining rectangles");
+		}
+	}
+}
+
+void test_merge(size_t cases, uint64_t seed) {
+	std::mt19937_64 rng(seed);
+	std::vector<Rectangle> parts;
+	for(size_t c = 0; c <= cases; ++c) {
+		//Ostatni przypadek jest duży, żeby sprawdzić głębokie podziały.
+		size_t pieces = c < cases ? 1 + rng() % 64 : 20000;
+		Rectangle whole(1 + rng() % 1000, 1 + rng() % 1000,
+				Position(fint(rng() % 2001) - 1000, fint(rng() % 2001) - 1000));
+		if(c == cases)
+			whole = Rectangle(1 << 20, 1 << 20, Position(-5, 7));
+		parts.clear();
+		guillotine(whole, pieces, rng, parts);
+		std::shuffle(parts.begin(), parts.end(), rng);
+		test_partition(whole, parts);
+
+		if(parts.size() > 1) {
+			parts.push_back(parts[rng() % parts.size()]);
+			std::shuffle(parts.begin(), parts.end(), rng);
+			expect_error(parts, MergeError::Reason::overlap, "duplicated rectangle");
+		}
+	}
+
+	//Wiatraczek: cztery prostokąty wokół środkowego, żadna prosta go nie rozcina.
+	std::vector<Rectangle> pinwheel = {Rectangle(2, 1, Position(0, 0)), Rectangle(1, 2, Position(2, 0)),
+			Rectangle(2, 1, Position(1, 2)), Rectangle(1, 2, Position(0, 1)), Rectangle(1, 1, Position(1, 1))};
+	for(int i = 0; i < 10; ++i) {
+		std::shuffle(pinwheel.begin(), pinwheel.end(), rng);
+		expect_error(pinwheel, MergeError::Reason::not_mergeable, "pinwheel");
+	}
+	//Wiatraczek w jednej części większego podziału.
+	std::vector<Rectangle> framed = pinwheel;
+	framed.push_back(Rectangle(3, 2, Position(0, 3)));
+	framed.push_back(Rectangle(2, 5, Position(3, 0)));
+	std::shuffle(framed.begin(), framed.end(), rng);
+	expect_error(framed, MergeError::Reason::not_mergeable, "framed pinwheel");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	size_t cases = 20000;
+	uint64_t seed = 418510;
+	int c;
+	while((c = getopt(argc, argv, "n:s:")) != -1) {
+		if(c == 'n' && atoll(optarg) >= 0) {
+			cases = atoll(optarg);
+		}
+		else if(c == 's') {
+			seed = strtoull(optarg, nullptr, 10);
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-n cases] [-s seed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	test_soa<int16_t>("RectanglesSoA<int16_t>");
+	test_soa<int32_t>("RectanglesSoA<int32_t>");
+	test_soa<int64_t>("RectanglesSoA<int64_t>");
+	test_merge(cases, seed);
+
+	if(failures > 0) {
+		fprintf(stderr, "%d test(s) failed\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}